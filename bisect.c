@@ -33,6 +33,7 @@
 #include "proc.h"
 #include "util.h"
 #include "tree.h"
+#include "extent.h"
 
 // This file is part of halfempty - a fast, parallel testcase minimization tool.
 //
@@ -93,31 +94,32 @@ static task_t * strategy_bisect_data(GNode *node)
 
     // We don't hold the lock on parent, but user data will never change.
     bisect_t *parentstatus  = parent->user;
-    bisect_t *childstatus   = g_new0(bisect_t, 1);
+    bisect_t *childstatus;
 
     g_debug("strategy_bisect_data(%p)", node);
 
-    // If this is the root node, we're being called to initialize a new tree.
-    if (parentstatus == NULL && G_NODE_IS_ROOT(node)) {
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
         g_debug("initializing a new root node size %lu", parent->size);
 
         // If this was already set, then something has gone wrong.
         g_assert_cmpint(g_node_n_children(node), ==, 0);
 
+        childstatus             = task_user_new(parent, sizeof(bisect_t));
         childstatus->offset     = 0;
         childstatus->chunksize  = parent->size;
-        parent->user            = childstatus;
         return parent;
     }
 
     g_assert_nonnull(parentstatus);
 
     // Initialize child from parent.
-    child           = g_new0(task_t, 1);
-    child->fd       = -1;
+    child           = task_new();
     child->size     = parent->size;
     child->status   = TASK_STATUS_PENDING;
-    child->user     = memcpy(childstatus, parentstatus, sizeof(bisect_t));
+    childstatus     = task_user_new(child, sizeof(bisect_t));
+
+    memcpy(childstatus, parentstatus, sizeof(bisect_t));
 
     // Check if we've finished a chunksize, which means we need to reset offset
     // to zero with a smaller chunksize. We continue until chunksize is zero.
@@ -129,7 +131,7 @@ static task_t * strategy_bisect_data(GNode *node)
 
         childstatus->offset       = 0;
         childstatus->chunksize  >>= 1;
-    } else if (parent->status != TASK_STATUS_SUCCESS) {
+    } else if (g_node_strategy_status(node) != TASK_STATUS_SUCCESS) {
         g_debug("parent failed or pending, trying next offset %lu => %lu",
                 childstatus->offset,
                 childstatus->offset + childstatus->chunksize);
@@ -150,21 +152,8 @@ static task_t * strategy_bisect_data(GNode *node)
         goto nochild;
     }
 
-    // Traverse up the tree to find the first SUCCESS node, we base our data on
-    // that.
-    if (source->status != TASK_STATUS_SUCCESS) {
-        for (GNode *current = node; current; current = current->parent) {
-            source = current->data;
-            if (source->status == TASK_STATUS_SUCCESS) {
-                break;
-            }
-        }
-
-        // The root node has TASK_STATUS_SUCCESS, so it is impossible that we
-        // can't find a node with TASK_STATUS_SUCCESS unless the tree is
-        // corrupt.
-        g_assert(source);
-    }
+    // Find the first SUCCESS node above us, we base our data on that.
+    source = g_node_source_task(node);
 
     // The source could be empty if the empty file worked, just give up I
     // guess?
@@ -178,50 +167,25 @@ static task_t * strategy_bisect_data(GNode *node)
             parent,
             source);
 
-    // OK, we need to access this fd, so acquire the lock.
+    // OK, we need to access this data, so acquire the lock.
     g_mutex_lock(&source->mutex);
 
-    // If it's success, the fd must be open and valid.
-    g_assert_cmpint(source->fd, !=, -1);
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
 
     // This cannot possibly be wrong.
-    g_assert_cmpuint(source->size, ==, g_file_size(source->fd));
-
-    // OK, we can do a bisection now.
-    child->fd = g_unlinked_tmp(NULL);
+    g_assert_cmpuint(source->size, ==, extent_size(source->extents));
 
     // I don't think this is possible.
     if (childstatus->offset > source->size)
         goto nochildunlock;
 
-    // Initialize the new child with everything up to offset.
-    if (g_sendfile_all(child->fd,
-                       source->fd,
-                       0,
-                       childstatus->offset) == false) {
-        g_error("sendfile failed while trying to construct new file, %s", strerror(errno));
-        goto nochildunlock;
-    }
-
-    child->size = childstatus->offset;
-
-    if (childstatus->offset + childstatus->chunksize <= source->size) {
-        if (g_sendfile_all(child->fd,
-                           source->fd,
-                           childstatus->offset + childstatus->chunksize,
-                           source->size
-                                - childstatus->chunksize
-                                - childstatus->offset) == false) {
-            g_error("sendfile failed while trying to construct new file, %s", strerror(errno));
-            goto nochildunlock;
-        }
-
-        child->size += source->size
-                        - childstatus->chunksize
-                        - childstatus->offset;
-    }
-
-    g_assert_cmpuint(child->size, ==, g_file_size(child->fd));
+    // OK, we can do a bisection now. If the chunk runs past the end of the
+    // file, this just truncates it at offset.
+    child->extents = extent_delete(source->extents,
+                                   childstatus->offset,
+                                   childstatus->chunksize);
+    child->size    = extent_size(child->extents);
 
     // Finished with source object.
     g_mutex_unlock(&source->mutex);
@@ -232,11 +196,10 @@ static task_t * strategy_bisect_data(GNode *node)
     g_mutex_unlock(&source->mutex);
 
   nochild:
-    if (child) {
-        close(child->fd);
+    if (child->extents) {
+        g_array_unref(child->extents);
     }
-    g_free(child);
-    g_free(childstatus);
+    task_free(child);
     return NULL;
 }
 
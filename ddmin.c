@@ -0,0 +1,174 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "ddmin"
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// This is the classic delta debugging algorithm. The data is split into n
+// chunks, and each round we try keeping only one chunk (a subset), then
+// removing one chunk (a complement).
+//
+//  * If a subset works, that chunk is the new data and n becomes 2.
+//  * If a complement works, that is the new data and n becomes n - 1.
+//  * If nothing works, n doubles until every chunk is a single byte.
+//
+// Every candidate in a round is derived from the same source, so we emit them
+// as a chain of predicted failures and the workers test them in parallel. The
+// first success in chain order wins and everything after it is discarded with
+// the rest of the failure branch, so the result doesn't depend on which
+// worker finishes first.
+//
+
+// The structure of our user data.
+typedef struct {
+    gsize   n;          // Number of chunks this round.
+    gint    index;      // Candidate within the round, -1 for the root.
+} ddmin_t;
+
+// Configurable Knobs.
+static gboolean kDdminEnabled = false;
+static gdouble kDdminSkipMultiplier = 0.0001;
+
+static const GOptionEntry kDdminOptions[] = {
+    { "ddmin", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kDdminEnabled,
+        "Run delta debugging before the other strategies.",
+        NULL },
+    { "ddmin-skip-multiplier", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+        &kDdminSkipMultiplier,
+        "Smallest chunk multiple, higher is faster but less thorough (default=0.0001).",
+        "multiplier" },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Test all subsets and complements of n chunks in parallel";
+
+// With two chunks, the complements are the same as the subsets.
+static gint round_length(gsize n)
+{
+    return n == 2 ? 2 : n * 2;
+}
+
+static task_t * strategy_ddmin_data(GNode *node)
+{
+    task_t  *child  = NULL;             // The new task we're about to return.
+    task_t  *parent = node->data;       // The task above us in the tree.
+    task_t  *source;                    // Where we get our data from.
+    gsize    start;
+    gsize    end;
+
+    // We don't hold the lock on parent, but user data will never change.
+    ddmin_t *parentstatus = parent->user;
+    ddmin_t *childstatus;
+
+    g_debug("strategy_ddmin_data(%p)", node);
+
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
+        if (kDdminEnabled == false || parent->size < 2)
+            return NULL;
+
+        childstatus         = task_user_new(parent, sizeof(ddmin_t));
+        childstatus->n      = 2;
+        childstatus->index  = -1;
+        return parent;
+    }
+
+    source = g_node_source_task(node);
+
+    // There's nothing left to split.
+    if (source->size < 2) {
+        g_info("source is too small to split");
+        return NULL;
+    }
+
+    // Initialize child from parent.
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+    childstatus     = task_user_new(child, sizeof(ddmin_t));
+
+    memcpy(childstatus, parentstatus, sizeof(ddmin_t));
+
+    if (g_node_strategy_status(node) == TASK_STATUS_SUCCESS
+     && !g_node_strategy_root(node)) {
+        // The parent worked, so a new round starts on its data.
+        if (parentstatus->index < parentstatus->n) {
+            g_info("subset %d of %lu worked", parentstatus->index, parentstatus->n);
+            childstatus->n = 2;
+        } else {
+            g_info("complement %lu of %lu worked",
+                   parentstatus->index - parentstatus->n,
+                   parentstatus->n);
+            childstatus->n = MAX(parentstatus->n - 1, 2);
+        }
+
+        childstatus->index = 0;
+    } else if (++childstatus->index == round_length(childstatus->n)) {
+        // Nothing worked, increase granularity. For very large files, going
+        // all the way down to 1 byte chunks is just too slow, the other
+        // strategies can finish the job.
+        if (childstatus->n >= source->size
+         || source->size / childstatus->n <= (gsize)(kDdminSkipMultiplier * source->size)) {
+            g_info("final round complete, n %lu", childstatus->n);
+            goto nochild;
+        }
+
+        childstatus->n      = MIN(childstatus->n * 2, source->size);
+        childstatus->index  = 0;
+
+        g_info("no candidates worked, n is now %lu", childstatus->n);
+    }
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    // Find the chunk this candidate is about.
+    start = (childstatus->index % childstatus->n) * source->size / childstatus->n;
+    end   = (childstatus->index % childstatus->n + 1) * source->size / childstatus->n;
+
+    if (childstatus->index < childstatus->n) {
+        GArray *prefix = extent_delete(source->extents, end, source->size - end);
+
+        child->extents = extent_delete(prefix, 0, start);
+
+        g_array_unref(prefix);
+    } else {
+        child->extents = extent_delete(source->extents, start, end - start);
+    }
+
+    child->size = extent_size(child->extents);
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+
+  nochild:
+    task_free(child);
+    return NULL;
+}
+
+// Add this strategy to the global list.
+REGISTER_STRATEGY(ddmin, kDescription, kDdminOptions, strategy_ddmin_data);
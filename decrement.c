@@ -0,0 +1,256 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "decrement"
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// Once the data is small, what's left is often large numbers and lengths that
+// make it hard to read. This strategy binary searches each byte for the
+// smallest value that still works, moving toward a target character.
+//
+// A binary search is sequential, so we work on a window of positions at a
+// time and take one step at each position in turn. Each candidate in a pass is
+// a different position, so as a chain of predicted failures they can all be
+// tested in parallel. A success just narrows the search at that position.
+//
+// Positions that are already the target (or below it) are skipped, runs of
+// them are found using the extent fill index without reading the data.
+//
+
+// The search at one position, the current value is hi and we know nothing
+// below lo works.
+typedef struct {
+    guchar  lo;
+    guchar  hi;
+    guchar  probed;     // The target itself has been tried.
+} position_t;
+
+// The structure of our user data.
+typedef struct {
+    gsize       base;       // Offset of the first position in the window.
+    guint       count;      // Number of positions in the window.
+    guint       index;      // Position this task tested, count for none.
+    position_t  positions[];
+} decrement_t;
+
+// Configurable Knobs.
+static gboolean kDecrementEnabled = false;
+static gint kDecrementCharacter = 0;
+static gint kDecrementWindow = 16;
+
+static const GOptionEntry kDecrementOptions[] = {
+    { "decrement", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kDecrementEnabled,
+        "Search for the smallest value of every byte after minimizing.",
+        NULL },
+    { "decrement-char", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+        &kDecrementCharacter,
+        "Decrement bytes toward this value (0-255) (default=0).",
+        "byte" },
+    { "decrement-window", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+        &kDecrementWindow,
+        "Number of positions searched in parallel (default=16).",
+        "positions" },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Binary search each byte for the smallest value that works";
+
+static gsize decrement_size(guint count)
+{
+    return sizeof(decrement_t) + sizeof(position_t) * count;
+}
+
+static guchar target_value(void)
+{
+    return (guchar) kDecrementCharacter;
+}
+
+// The value we try next at this position.
+static guchar next_value(const position_t *position)
+{
+    if (position->probed == false)
+        return position->lo;
+
+    return position->lo + (position->hi - position->lo) / 2;
+}
+
+// Move the window to the next positions at or after base that aren't already
+// minimal. Returns false if there are none left.
+static gboolean load_window(decrement_t *status, GArray *extents, gsize size, gsize base)
+{
+    guchar data[status->count];
+    gsize  length;
+    gboolean found = false;
+
+    while (found == false && base < size) {
+        length = MIN(status->count, size - base);
+
+        // Skip runs that are already the target without looking at them.
+        if (extent_is_filled(extents, base, length, target_value())) {
+            base += length;
+            continue;
+        }
+
+        g_assert_cmpint(extent_read(extents, data, length, base), ==, length);
+
+        for (guint i = 0; i < status->count; i++) {
+            position_t *position = &status->positions[i];
+
+            if (i >= length || data[i] <= target_value()) {
+                position->lo = position->hi = i < length ? data[i] : 0;
+                continue;
+            }
+
+            position->lo        = target_value();
+            position->hi        = data[i];
+            position->probed    = false;
+            found               = true;
+        }
+
+        status->base = base;
+        base        += length;
+    }
+
+    status->index = status->count;
+    return found;
+}
+
+// Find the next position in the window still being searched, wrapping around
+// to start another pass. Returns false if every search is complete.
+static gboolean next_position(decrement_t *status, gsize size)
+{
+    guint start = status->index < status->count ? status->index + 1 : 0;
+
+    for (guint i = 0; i < status->count; i++) {
+        guint index = (start + i) % status->count;
+
+        // The data could have been truncated since we loaded the window.
+        if (status->base + index >= size)
+            continue;
+
+        if (status->positions[index].lo < status->positions[index].hi) {
+            status->index = index;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static task_t * strategy_decrement_data(GNode *node)
+{
+    task_t      *child  = NULL;         // The new task we're about to return.
+    task_t      *parent = node->data;   // The task above us in the tree.
+    task_t      *source;                // Where we get our data from.
+
+    // We don't hold the lock on parent, but user data will never change.
+    decrement_t *parentstatus = parent->user;
+    decrement_t *childstatus;
+
+    g_debug("strategy_decrement_data(%p)", node);
+
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
+        guint count = CLAMP(kDecrementWindow, 1, 256);
+
+        if (kDecrementEnabled == false)
+            return NULL;
+
+        childstatus         = task_user_new(parent, decrement_size(count));
+        childstatus->count  = count;
+
+        g_mutex_lock(&parent->mutex);
+
+        if (load_window(childstatus, parent->extents, parent->size, 0) == false) {
+            g_mutex_unlock(&parent->mutex);
+            g_info("every byte is already minimal");
+            task_user_free(parent);
+            return NULL;
+        }
+
+        g_mutex_unlock(&parent->mutex);
+        return parent;
+    }
+
+    // Initialize child from parent.
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+    childstatus     = task_user_new(child, decrement_size(parentstatus->count));
+
+    memcpy(childstatus, parentstatus, decrement_size(parentstatus->count));
+
+    // Narrow the search at the position the parent tested.
+    if (childstatus->index < childstatus->count) {
+        position_t *position = &childstatus->positions[childstatus->index];
+        guchar      value    = next_value(position);
+
+        if (g_node_strategy_status(node) == TASK_STATUS_SUCCESS
+         && !g_node_strategy_root(node)) {
+            position->hi = value;
+        } else {
+            position->lo = value + 1;
+        }
+
+        position->probed = true;
+    }
+
+    source = g_node_source_task(node);
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    // When every search in the window is done, move on to the next one.
+    while (next_position(childstatus, source->size) == false) {
+        if (load_window(childstatus,
+                        source->extents,
+                        source->size,
+                        childstatus->base + childstatus->count) == false) {
+            g_info("final window complete");
+            goto nochildunlock;
+        }
+    }
+
+    child->extents = extent_fill(source->extents,
+                                 childstatus->base + childstatus->index,
+                                 1,
+                                 next_value(&childstatus->positions[childstatus->index]));
+
+    // Size should never change for this strategy.
+    child->size = source->size;
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+
+  nochildunlock:
+    g_mutex_unlock(&source->mutex);
+    task_free(child);
+    return NULL;
+}
+
+// Add this strategy to the global list.
+REGISTER_STRATEGY(decrement, kDescription, kDecrementOptions, strategy_decrement_data);
@@ -0,0 +1,416 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "dedup"
+#include <glib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// Fuzzer output often contains the same block repeated many times, and bisect
+// can only remove the copies a chunk at a time. This strategy finds repeated
+// substrings and tries removing every copy, or every copy but the first, in a
+// single candidate.
+//
+// Repeats are found with a rolling hash over power of two lengths, once per
+// source. The candidates are tried in order of how many bytes they would
+// save, as a chain of predicted failures so they can be tested in parallel.
+//
+
+// A candidate removal.
+typedef struct {
+    gsize       length;     // Length of the repeated substring.
+    gsize       saved;      // Number of bytes this removes.
+    gboolean    keepfirst;  // Leave the first copy in place.
+    GArray     *positions;  // Where the copies start, ascending.
+} repeat_t;
+
+// The structure of our user data.
+typedef struct {
+    guint   index;          // Candidate in the repeat index.
+} dedup_t;
+
+// A window of the data and its hash, used while building the index.
+typedef struct {
+    guint64 hash;
+    gsize   position;
+} window_t;
+
+// Configurable Knobs.
+static gboolean kDedupEnabled = false;
+static gint kDedupMinLength = 8;
+static gint kDedupMinCopies = 3;
+static gint kDedupCandidates = 64;
+
+static const GOptionEntry kDedupOptions[] = {
+    { "dedup", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kDedupEnabled,
+        "Remove repeated substrings before the other strategies.",
+        NULL },
+    { "dedup-min-length", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+        &kDedupMinLength,
+        "Shortest repeated substring to consider (default=8).",
+        "bytes" },
+    { "dedup-min-copies", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+        &kDedupMinCopies,
+        "Only remove substrings repeated at least this many times (default=3).",
+        "count" },
+    { "dedup-candidates", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+        &kDedupCandidates,
+        "Maximum number of candidates to try for each source (default=64).",
+        "count" },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Remove every copy of repeated substrings at once";
+
+// Multiplier for the rolling hash, arithmetic is modulo 2^64.
+static const guint64 kHashMultiplier = 0x100000001b3ULL;
+
+// The most recent repeat index, and the extents it was created from. We hold a
+// reference to the extents so the pointer can't be reused.
+static GArray *indexextents;
+static GArray *repeatindex;
+
+static gint compare_windows(gconstpointer a, gconstpointer b)
+{
+    const window_t *x = a;
+    const window_t *y = b;
+
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+
+    return (x->position > y->position) - (x->position < y->position);
+}
+
+// Most bytes saved first, then longer substrings, then earlier ones, so the
+// order is reproducible.
+static gint compare_repeats(gconstpointer a, gconstpointer b)
+{
+    const repeat_t *x = a;
+    const repeat_t *y = b;
+    gsize px = g_array_index(x->positions, gsize, 0);
+    gsize py = g_array_index(y->positions, gsize, 0);
+
+    if (x->saved != y->saved)
+        return x->saved > y->saved ? -1 : 1;
+    if (x->length != y->length)
+        return x->length > y->length ? -1 : 1;
+    if (px != py)
+        return px < py ? -1 : 1;
+
+    return x->keepfirst - y->keepfirst;
+}
+
+static void clear_repeat(gpointer data)
+{
+    g_array_unref(((repeat_t *) data)->positions);
+}
+
+// Keep only the best candidates.
+static void trim_repeats(GArray *repeats)
+{
+    g_array_sort(repeats, compare_repeats);
+
+    if (repeats->len > (guint) kDedupCandidates) {
+        g_array_set_size(repeats, kDedupCandidates);
+    }
+}
+
+// Find repeats of exactly length bytes and add them to repeats.
+static void find_repeats(GArray *repeats, const guchar *data, gsize size, gsize length)
+{
+    gsize     count   = size - length + 1;
+    guint     bits    = g_bit_storage(count) + 2;
+    guint64  *hashes  = g_new(guint64, count);
+    guchar   *buckets = g_malloc0(1UL << bits);
+    window_t *windows;
+    guchar   *covered;
+    guint64   power   = 1;
+    guint64   hash    = 0;
+    guint     minimum = MAX(kDedupMinCopies, 2);
+    gsize     used    = 0;
+    GArray   *groups;
+
+    for (gsize i = 0; i < length; i++) {
+        hash = hash * kHashMultiplier + data[i];
+
+        if (i > 0) {
+            power *= kHashMultiplier;
+        }
+    }
+
+    // Most windows are unique, so count roughly how often each hash appears
+    // and only sort the ones that could be repeated enough.
+    for (gsize i = 0; i < count; i++) {
+        guchar *bucket = &buckets[hash >> (64 - bits)];
+
+        hashes[i] = hash;
+
+        if (*bucket < G_MAXUINT8)
+            (*bucket)++;
+
+        if (i + length < size) {
+            hash = (hash - data[i] * power) * kHashMultiplier + data[i + length];
+        }
+    }
+
+    windows = g_new(window_t, count);
+
+    for (gsize i = 0; i < count; i++) {
+        if (buckets[hashes[i] >> (64 - bits)] < minimum)
+            continue;
+
+        windows[used].hash      = hashes[i];
+        windows[used].position  = i;
+        used++;
+    }
+
+    g_free(hashes);
+    g_free(buckets);
+
+    qsort(windows, used, sizeof(window_t), compare_windows);
+
+    groups  = g_array_new(false, false, sizeof(repeat_t));
+    covered = g_malloc0(size);
+
+    g_array_set_clear_func(groups, clear_repeat);
+
+    // Every run of equal hashes is a possible repeat, take the copies that
+    // match the first and don't overlap.
+    for (gsize start = 0, end; start < used; start = end) {
+        repeat_t  repeat = { length, 0, false, NULL };
+        gsize     first  = windows[start].position;
+        gsize     last   = first;
+
+        for (end = start + 1; end < used && windows[end].hash == windows[start].hash; end++)
+            ;
+
+        if (end - start < minimum)
+            continue;
+
+        repeat.positions = g_array_new(false, false, sizeof(gsize));
+
+        g_array_append_val(repeat.positions, first);
+
+        for (gsize i = start + 1; i < end; i++) {
+            gsize position = windows[i].position;
+
+            if (position < last + length)
+                continue;
+            if (memcmp(data + first, data + position, length) != 0)
+                continue;
+
+            g_array_append_val(repeat.positions, position);
+            last = position;
+        }
+
+        if (repeat.positions->len < minimum) {
+            g_array_unref(repeat.positions);
+            continue;
+        }
+
+        repeat.saved = repeat.positions->len * length;
+
+        g_array_append_val(groups, repeat);
+    }
+
+    // A block repeated many times also repeats at every shift within it, only
+    // keep the best of those.
+    g_array_sort(groups, compare_repeats);
+
+    for (guint i = 0; i < groups->len; i++) {
+        repeat_t *repeat = &g_array_index(groups, repeat_t, i);
+        gboolean  overlap = false;
+
+        for (guint j = 0; j < repeat->positions->len && !overlap; j++) {
+            gsize position = g_array_index(repeat->positions, gsize, j);
+
+            overlap = covered[position] || covered[position + length - 1];
+        }
+
+        if (overlap)
+            continue;
+
+        for (guint j = 0; j < repeat->positions->len; j++) {
+            memset(covered + g_array_index(repeat->positions, gsize, j), true, length);
+        }
+
+        // We can try removing every copy, or all but the first.
+        g_array_append_val(repeats, *repeat);
+        g_array_ref(repeat->positions);
+
+        repeat->keepfirst   = true;
+        repeat->saved      -= length;
+        g_array_append_val(repeats, *repeat);
+        g_array_ref(repeat->positions);
+    }
+
+    g_array_unref(groups);
+    g_free(covered);
+    g_free(windows);
+
+    trim_repeats(repeats);
+}
+
+// Create a list of candidate removals for this data, best first.
+static GArray * build_repeat_index(GArray *extents)
+{
+    GArray *repeats = g_array_new(false, false, sizeof(repeat_t));
+    gsize   size    = extent_size(extents);
+    guchar *data    = g_malloc(size);
+    gsize   length  = MAX(kDedupMinLength, 1);
+
+    g_array_set_clear_func(repeats, clear_repeat);
+
+    extent_read(extents, data, size, 0);
+
+    // There must be room for two copies.
+    while (length * 2 <= size / 2) {
+        length *= 2;
+    }
+
+    for (; length >= (gsize) MAX(kDedupMinLength, 1) && length * 2 <= size; length /= 2) {
+        find_repeats(repeats, data, size, length);
+    }
+
+    g_free(data);
+
+    g_debug("found %u candidates in %lu bytes", repeats->len, size);
+
+    return repeats;
+}
+
+// Return the repeat index for this data, creating it if necessary.
+// XXX: must hold tree lock.
+static GArray * get_repeat_index(GArray *extents)
+{
+    if (indexextents != extents) {
+        if (indexextents) {
+            g_array_unref(indexextents);
+            g_array_unref(repeatindex);
+        }
+
+        indexextents = g_array_ref(extents);
+        repeatindex  = build_repeat_index(extents);
+    }
+
+    return repeatindex;
+}
+
+static task_t * strategy_dedup_data(GNode *node)
+{
+    task_t   *child  = NULL;            // The new task we're about to return.
+    task_t   *parent = node->data;      // The task above us in the tree.
+    task_t   *source;                   // Where we get our data from.
+    GArray   *index;
+    GArray   *extents;
+    repeat_t *repeat;
+
+    // We don't hold the lock on parent, but user data will never change.
+    dedup_t  *parentstatus = parent->user;
+    dedup_t  *childstatus;
+
+    g_debug("strategy_dedup_data(%p)", node);
+
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
+        if (kDedupEnabled == false || kDedupCandidates <= 0)
+            return NULL;
+
+        g_mutex_lock(&parent->mutex);
+        index = get_repeat_index(parent->extents);
+        g_mutex_unlock(&parent->mutex);
+
+        if (index->len == 0) {
+            g_info("no repeated substrings found");
+            return NULL;
+        }
+
+        task_user_new(parent, sizeof(dedup_t));
+        return parent;
+    }
+
+    // Initialize child from parent.
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+    childstatus     = task_user_new(child, sizeof(dedup_t));
+
+    memcpy(childstatus, parentstatus, sizeof(dedup_t));
+
+    // If the parent worked, the index for the new data has different
+    // candidates, so start again from the best one. Otherwise, move on.
+    if (g_node_strategy_root(node) == false) {
+        if (g_node_strategy_status(node) == TASK_STATUS_SUCCESS) {
+            childstatus->index = 0;
+        } else {
+            childstatus->index++;
+        }
+    }
+
+    source = g_node_source_task(node);
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    index = get_repeat_index(source->extents);
+
+    if (childstatus->index >= index->len) {
+        g_info("every candidate has been tried");
+        goto nochildunlock;
+    }
+
+    repeat  = &g_array_index(index, repeat_t, childstatus->index);
+    extents = g_array_ref(source->extents);
+
+    g_debug("removing %u copies of %lu bytes, saving %lu",
+            repeat->positions->len - repeat->keepfirst,
+            repeat->length,
+            repeat->saved);
+
+    // Work from the end, so that earlier offsets are still correct.
+    for (guint i = repeat->positions->len; i-- > repeat->keepfirst;) {
+        GArray *result = extent_delete(extents,
+                                       g_array_index(repeat->positions, gsize, i),
+                                       repeat->length);
+
+        g_array_unref(extents);
+        extents = result;
+    }
+
+    child->extents = extents;
+    child->size    = extent_size(child->extents);
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+
+  nochildunlock:
+    g_mutex_unlock(&source->mutex);
+    task_free(child);
+    return NULL;
+}
+
+// Add this strategy to the global list.
+REGISTER_STRATEGY(dedup, kDescription, kDedupOptions, strategy_dedup_data);
@@ -0,0 +1,644 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "extent.h"
+#include "util.h"
+#include "storage.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// Candidates are never copied, they're described as a list of extents over the
+// original input, which never changes. Strategies create new candidates by
+// editing the extent list of an existing one, so the cost of a new candidate
+// is proportional to the number of edits, not the size of the file.
+//
+// The data is only produced when it's delivered to a child process, or when
+// we need to write it out.
+//
+
+// A private copy of the original input data, all data extents refer to this.
+// The user might modify or truncate their file while we're running, and we
+// don't want to see that, especially through the mapping.
+static gint inputfd = -1;
+
+// The input is also mapped once, so that data can be handed to the kernel
+// without copying. This is NULL if the input couldn't be mapped.
+static guchar *inputmap;
+static gsize   inputmapsize;
+
+// Fill runs are delivered from a buffer of the fill byte, these are created
+// when first needed and never modified or freed.
+static guchar *fillbuffers[256];
+static GMutex  fillbufferlock;
+
+// Size of each fill buffer.
+static const gsize kFillBufferSize = 64 * 1024;
+
+// The largest pipe we will ask for, anything above the default
+// /proc/sys/fs/pipe-max-size would fail for unprivileged users anyway.
+static const gint kMaxPipeSize = 1024 * 1024;
+
+// The number of iovecs we pass to vmsplice() at a time.
+#define MAX_IOVECS 64
+
+// For each fill byte we're asked about, an index of where the input already
+// contains runs of that byte. This is an ordered list of extents, built the
+// first time it's needed.
+static GArray *fillindex[256];
+static GMutex  fillindexlock;
+
+// Runs shorter than this aren't indexed, short queries just check the data.
+static const gsize kMinIndexedRun = 16;
+
+// Take a copy of the input in fd, returns the size of the copy.
+gsize extent_set_input(gint fd)
+{
+    struct stat st;
+    gsize size;
+
+    if (inputmap) {
+        munmap(inputmap, inputmapsize);
+    }
+
+    if (inputfd != -1) {
+        storage_release(inputfd);
+    }
+
+    for (gint i = 0; i < G_N_ELEMENTS(fillindex); i++) {
+        g_clear_pointer(&fillindex[i], g_array_unref);
+    }
+
+    inputfd      = storage_acquire();
+    inputmap     = NULL;
+    inputmapsize = 0;
+    size         = g_file_size(fd);
+
+    if (inputfd < 0) {
+        g_error("failed to create temporary file, %s", strerror(errno));
+    }
+
+    if (storage_copy(inputfd, fd, 0, size) == false) {
+        g_error("failed to copy input data, %s", strerror(errno));
+    }
+
+    if (fstat(inputfd, &st) == 0 && st.st_size > 0) {
+        inputmap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, inputfd, 0);
+
+        if (inputmap == MAP_FAILED) {
+            g_debug("failed to map input, %s", strerror(errno));
+            inputmap = NULL;
+        } else {
+            inputmapsize = st.st_size;
+        }
+    }
+
+    return size;
+}
+
+static const guchar * get_fill_buffer(gint fill)
+{
+    guchar *buffer;
+
+    g_mutex_lock(&fillbufferlock);
+
+    if ((buffer = fillbuffers[fill & 0xff]) == NULL) {
+        buffer = fillbuffers[fill & 0xff] = g_malloc(kFillBufferSize);
+        memset(buffer, fill, kFillBufferSize);
+    }
+
+    g_mutex_unlock(&fillbufferlock);
+    return buffer;
+}
+
+// Record a run of fill in the index if it's long enough to be worth it.
+static void index_fill_run(GArray *index, gsize start, gsize end, gint fill)
+{
+    extent_t run = {
+        .offset = start,
+        .length = end - start,
+        .fill   = fill,
+    };
+
+    if (run.length >= kMinIndexedRun) {
+        g_array_append_val(index, run);
+    }
+}
+
+// Scan the input mapping for runs of fill. This is the only time we look at
+// every byte, so it's worth doing 16 bytes at a time where we can.
+static GArray * build_fill_index(gint fill)
+{
+    GArray *index = g_array_new(false, false, sizeof(extent_t));
+    gssize  start = -1;         // Start of the current run, or -1.
+    gsize   i     = 0;
+
+#ifdef __SSE2__
+    __m128i pattern = _mm_set1_epi8(fill);
+
+    for (; i + 16 <= inputmapsize; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(inputmap + i));
+        guint   mask  = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+
+        // The common cases are that nothing or everything changed.
+        if (mask == 0xffff && start != -1)
+            continue;
+        if (mask == 0 && start == -1)
+            continue;
+
+        for (gsize j = 0; j < 16; j++) {
+            if (mask & (1 << j)) {
+                if (start == -1)
+                    start = i + j;
+            } else if (start != -1) {
+                index_fill_run(index, start, i + j, fill);
+                start = -1;
+            }
+        }
+    }
+#endif
+
+    for (; i < inputmapsize; i++) {
+        if (inputmap[i] == fill) {
+            if (start == -1)
+                start = i;
+        } else if (start != -1) {
+            index_fill_run(index, start, i, fill);
+            start = -1;
+        }
+    }
+
+    if (start != -1) {
+        index_fill_run(index, start, inputmapsize, fill);
+    }
+
+    g_debug("found %u runs of %#02x in input", index->len, fill);
+
+    return index;
+}
+
+// Returns true if the input data in this range is all fill.
+static gboolean input_is_filled(goffset offset, gsize length, gint fill)
+{
+    guchar  buf[BUFSIZ];
+    GArray *index;
+    guint   lo, hi;
+
+    // If the input isn't mapped, we have to read it.
+    if (inputmap == NULL) {
+        while (length > 0) {
+            gsize count = MIN(length, sizeof buf);
+
+            if (pread(inputfd, buf, count, offset) != count)
+                return false;
+
+            for (gsize i = 0; i < count; i++) {
+                if (buf[i] != fill)
+                    return false;
+            }
+
+            offset += count;
+            length -= count;
+        }
+
+        return true;
+    }
+
+    // Short ranges might not be in the index, but are quick to check.
+    if (length < kMinIndexedRun) {
+        for (gsize i = 0; i < length; i++) {
+            if (inputmap[offset + i] != fill)
+                return false;
+        }
+
+        return true;
+    }
+
+    g_mutex_lock(&fillindexlock);
+
+    if ((index = fillindex[fill]) == NULL) {
+        index = fillindex[fill] = build_fill_index(fill);
+    }
+
+    g_mutex_unlock(&fillindexlock);
+
+    // Find the last run that starts at or before offset.
+    for (lo = 0, hi = index->len; lo < hi;) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (g_array_index(index, extent_t, mid).offset <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0)
+        return false;
+
+    extent_t *run = &g_array_index(index, extent_t, lo - 1);
+
+    return offset + length <= run->offset + run->length;
+}
+
+// Create a new list of extents that represents the entire input.
+GArray * extent_new_input(gsize size)
+{
+    GArray *extents = g_array_new(false, false, sizeof(extent_t));
+    extent_t data = {
+        .offset = 0,
+        .length = size,
+        .fill   = EXTENT_DATA,
+    };
+
+    if (size > 0) {
+        g_array_append_val(extents, data);
+    }
+
+    return extents;
+}
+
+gsize extent_size(GArray *extents)
+{
+    gsize size = 0;
+
+    for (guint i = 0; i < extents->len; i++) {
+        size += g_array_index(extents, extent_t, i).length;
+    }
+
+    return size;
+}
+
+// Append an extent, merging it with the previous one if they're contiguous.
+static void append_extent(GArray *extents, const extent_t *extent)
+{
+    extent_t *last;
+
+    if (extent->length == 0)
+        return;
+
+    if (extents->len > 0) {
+        last = &g_array_index(extents, extent_t, extents->len - 1);
+
+        if (last->fill == EXTENT_DATA
+         && extent->fill == EXTENT_DATA
+         && last->offset + last->length == extent->offset) {
+            last->length += extent->length;
+            return;
+        }
+
+        if (last->fill != EXTENT_DATA && last->fill == extent->fill) {
+            last->length += extent->length;
+            return;
+        }
+    }
+
+    g_array_append_val(extents, *extent);
+}
+
+// Append the extents that describe length bytes starting at offset in source.
+static void copy_extent_range(GArray *dest,
+                              GArray *source,
+                              gsize offset,
+                              gsize length)
+{
+    gsize position = 0;
+
+    for (guint i = 0; i < source->len && length > 0; i++) {
+        extent_t *extent = &g_array_index(source, extent_t, i);
+        extent_t  piece;
+        gsize     start  = MAX(position, offset);
+        gsize     end    = MIN(position + extent->length, offset + length);
+
+        if (start < end) {
+            piece.offset = extent->offset + (start - position);
+            piece.length = end - start;
+            piece.fill   = extent->fill;
+            append_extent(dest, &piece);
+        }
+
+        position += extent->length;
+
+        if (position >= offset + length)
+            break;
+    }
+}
+
+// Create a new list of extents with length bytes at offset removed.
+GArray * extent_delete(GArray *source, gsize offset, gsize length)
+{
+    GArray *extents = g_array_new(false, false, sizeof(extent_t));
+
+    copy_extent_range(extents, source, 0, offset);
+    copy_extent_range(extents, source, offset + length, G_MAXSIZE - offset - length);
+
+    return extents;
+}
+
+// Create a new list of extents with length bytes at offset replaced by fill.
+GArray * extent_fill(GArray *source, gsize offset, gsize length, gint fill)
+{
+    GArray *extents = g_array_new(false, false, sizeof(extent_t));
+    extent_t run = {
+        .offset = 0,
+        .length = length,
+        .fill   = fill,
+    };
+
+    g_assert_cmpint(fill, !=, EXTENT_DATA);
+
+    copy_extent_range(extents, source, 0, offset);
+    append_extent(extents, &run);
+    copy_extent_range(extents, source, offset + length, G_MAXSIZE - offset - length);
+
+    return extents;
+}
+
+// Just like pread(), but for a list of extents.
+gssize extent_read(GArray *extents, gpointer buf, gsize count, gsize offset)
+{
+    GArray *range = g_array_new(false, false, sizeof(extent_t));
+    guchar *out   = buf;
+    gsize   total = 0;
+
+    copy_extent_range(range, extents, offset, count);
+
+    for (guint i = 0; i < range->len; i++) {
+        extent_t *extent = &g_array_index(range, extent_t, i);
+
+        if (extent->fill != EXTENT_DATA) {
+            memset(out + total, extent->fill, extent->length);
+        } else if (inputmap) {
+            memcpy(out + total, inputmap + extent->offset, extent->length);
+        } else if (pread(inputfd,
+                         out + total,
+                         extent->length,
+                         extent->offset) != extent->length) {
+            g_warning("failed to read input data, %s", strerror(errno));
+            break;
+        }
+
+        total += extent->length;
+    }
+
+    g_array_unref(range);
+    return total;
+}
+
+// Returns true if every byte in this range is already fill, so there's no
+// point in trying to fill it. Only the part of the range inside the data is
+// considered.
+gboolean extent_is_filled(GArray *extents, gsize offset, gsize length, gint fill)
+{
+    GArray  *range  = g_array_new(false, false, sizeof(extent_t));
+    gboolean result = true;
+
+    fill &= 0xff;
+
+    copy_extent_range(range, extents, offset, length);
+
+    for (guint i = 0; result && i < range->len; i++) {
+        extent_t *extent = &g_array_index(range, extent_t, i);
+
+        if (extent->fill != EXTENT_DATA) {
+            result = extent->fill == fill;
+        } else {
+            result = input_is_filled(extent->offset, extent->length, fill);
+        }
+    }
+
+    g_array_unref(range);
+    return result;
+}
+
+// Write length copies of fill to fd, adding the number of bytes written to
+// written.
+static gboolean write_fill(gint fd, gint fill, gsize length, gsize *written)
+{
+    gchar   buf[BUFSIZ];
+    gssize  result;
+
+    memset(buf, fill, MIN(length, sizeof buf));
+
+    while (length > 0) {
+        if ((result = write(fd, buf, MIN(length, sizeof buf))) < 0) {
+            return false;
+        }
+
+        length   -= result;
+        *written += result;
+    }
+
+    return true;
+}
+
+// Write all of buf to fd, write() is allowed to return early.
+static gboolean write_all(gint fd, const gchar *buf, gsize length)
+{
+    gssize result;
+
+    while (length > 0) {
+        if ((result = write(fd, buf, length)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        buf    += result;
+        length -= result;
+    }
+
+    return true;
+}
+
+// Write out the data described by extents to a file.
+gboolean extent_write_fd(GArray *extents, gint fd)
+{
+    gsize size = extent_size(extents);
+    gsize written = 0;
+
+    // Small files might be faster to assemble and write in one go.
+    if (storage_buffered(size)) {
+        gchar   *buf    = g_malloc(size);
+        gboolean result = extent_read(extents, buf, size, 0) == size
+                       && write_all(fd, buf, size);
+        g_free(buf);
+        return result;
+    }
+
+    for (guint i = 0; i < extents->len; i++) {
+        extent_t *extent = &g_array_index(extents, extent_t, i);
+
+        if (extent->fill != EXTENT_DATA) {
+            if (write_fill(fd, extent->fill, extent->length, &written) == false) {
+                return false;
+            }
+        } else if (storage_copy(fd,
+                                inputfd,
+                                extent->offset,
+                                extent->length) == false) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#ifdef __linux__
+// Hand all of the buffers described by iov to the pipe.
+static gboolean vmsplice_all(gint pipefd, struct iovec *iov, gint count, gsize *written)
+{
+    gssize result;
+
+    while (count > 0) {
+        if ((result = vmsplice(pipefd, iov, count, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_debug("failed to vmsplice data into pipe, %s", strerror(errno));
+            return false;
+        }
+
+        *written += result;
+
+        // Skip any buffers that were completely consumed.
+        for (; count > 0 && (gsize) result >= iov->iov_len; iov++, count--) {
+            result -= iov->iov_len;
+        }
+
+        if (count > 0) {
+            iov->iov_base  = (guchar *)(iov->iov_base) + result;
+            iov->iov_len  -= result;
+        }
+    }
+
+    return true;
+}
+
+// Deliver the data described by extents straight from the input mapping and
+// fill buffers. Nothing is copied, the pipe just refers to the pages, which is
+// safe because neither are ever modified.
+static gboolean extent_vmsplice(GArray *extents, gint pipefd, gsize *written)
+{
+    struct iovec iov[MAX_IOVECS];
+    gint count = 0;
+
+    for (guint i = 0; i < extents->len; i++) {
+        extent_t *extent = &g_array_index(extents, extent_t, i);
+        gsize     size   = extent->length;
+
+        while (size > 0) {
+            if (count == MAX_IOVECS) {
+                if (vmsplice_all(pipefd, iov, count, written) == false)
+                    return false;
+                count = 0;
+            }
+
+            if (extent->fill == EXTENT_DATA) {
+                iov[count].iov_base = inputmap + extent->offset;
+                iov[count].iov_len  = size;
+            } else {
+                iov[count].iov_base = (gpointer) get_fill_buffer(extent->fill);
+                iov[count].iov_len  = MIN(size, kFillBufferSize);
+            }
+
+            size -= iov[count++].iov_len;
+        }
+    }
+
+    return vmsplice_all(pipefd, iov, count, written);
+}
+#endif
+
+// Stream the data described by extents into a pipe, it's normal for this to
+// fail if the child doesn't read all of its input. The number of bytes the pipe
+// accepted is stored in written, whether or not we succeed.
+gboolean extent_write_pipe(GArray *extents, gint pipefd, gsize *written)
+{
+    g_assert_cmpint(pipefd, >, 0);
+
+    *written = 0;
+
+#ifdef __linux__
+    // Try to make the pipe big enough for the whole candidate, so that we're
+    // not woken up for every 64K the child reads. It's fine if this fails.
+    fcntl(pipefd, F_SETPIPE_SZ, CLAMP(extent_size(extents), 64 * 1024, kMaxPipeSize));
+
+    if (inputmap) {
+        return extent_vmsplice(extents, pipefd, written);
+    }
+#endif
+
+    for (guint i = 0; i < extents->len; i++) {
+        extent_t *extent = &g_array_index(extents, extent_t, i);
+        goffset   offset = extent->offset;
+        gsize     size   = extent->length;
+        gssize    result;
+
+        if (extent->fill != EXTENT_DATA) {
+            if (write_fill(pipefd, extent->fill, size, written) == false) {
+                g_debug("failed to write fill data into pipe, %s", strerror(errno));
+                return false;
+            }
+            continue;
+        }
+
+        while (size > 0) {
+            if ((result = splice(inputfd, &offset, pipefd, NULL, size, 0)) <= 0) {
+                // Probably broken pipe? I think this is okay, but should
+                // check that's the real reason
+                g_debug("failed to splice all data into pipe, %lu remaining", size);
+                return false;
+            }
+
+            size     -= result;
+            *written += result;
+        }
+    }
+
+    return true;
+}
+
+// Create a real file containing this data, used for output.
+gint extent_materialize(GArray *extents)
+{
+    gint fd = storage_acquire();
+
+    if (fd < 0) {
+        g_error("failed to create temporary file, %s", strerror(errno));
+    }
+
+    if (extent_write_fd(extents, fd) == false) {
+        g_error("failed to write out data, %s", strerror(errno));
+    }
+
+    return fd;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __EXTENT_H
+#define __EXTENT_H
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+
+#define EXTENT_DATA (-1)
+
+// A candidate is described as a list of extents, each one is either a range of
+// the original input data, or a run of a single fill byte.
+typedef struct {
+    goffset offset;     // Offset into the input data, unused for fill runs.
+    gsize   length;     // Number of bytes.
+    gint    fill;       // Fill byte, or EXTENT_DATA.
+} extent_t;
+
+gsize extent_set_input(gint fd);
+GArray * extent_new_input(gsize size);
+gsize extent_size(GArray *extents);
+GArray * extent_delete(GArray *source, gsize offset, gsize length);
+GArray * extent_fill(GArray *source, gsize offset, gsize length, gint fill);
+gssize extent_read(GArray *extents, gpointer buf, gsize count, gsize offset);
+gboolean extent_is_filled(GArray *extents, gsize offset, gsize length, gint fill);
+gboolean extent_write_fd(GArray *extents, gint fd);
+gboolean extent_write_pipe(GArray *extents, gint pipefd, gsize *written);
+gint extent_materialize(GArray *extents);
+
+#else
+# warning extent.h included twice
+#endif
@@ -32,14 +32,28 @@
 // numbers might speed up minimizing very slow files, otherwise keep it small.
 // The problem is if you set this too high, we might go down the wrong path too
 // far and pay a performance penalty to recover.
+// Unless kAdaptiveQueue is disabled, this is only the initial value, the
+// generator tunes it at runtime (see adjust_queue_depth() in tree.c), but
+// never above this or kProcessThreads, whichever is larger.
 guint kMaxUnprocessed = 2;
 
+// Allow the generator to tune kMaxUnprocessed based on how often our guesses
+// about test results turn out to be wrong.
+gboolean kAdaptiveQueue = true;
+
+// Every pending candidate has to be produced in full when it's delivered to a
+// child, so for very large inputs the queue represents a lot of data. If
+// non-zero, the generator holds back work while pending tasks represent more
+// than this many bytes.
+gint64 kMaxSpeculativeBytes = 0;
+
 // Number of threads dedicated to executing tests.
 // Unless overridden at runtime, this is set to number of available cores.
 guint kProcessThreads = 32;
 
 // Number of threads dedicated to cleaning up resources (~4 is reasonable).
-// These threads mostly wait on locks and hardly consume any resources.
+// These threads never wait for children to exit and hardly consume any
+// resources.
 guint kCleanupThreads = 4;
 
 // How long to sleep between checking if we need more work.
@@ -91,6 +105,14 @@ gboolean kContinueSearch = false;
 // re-run the bisection until the result is stable (i.e. doesn't change).
 gboolean kIterateUntilStable = false;
 
+// Start speculative work for the next strategy on our best guess of the output
+// of the previous strategy, rather than waiting for it to be finalized.
+gboolean kOverlapStrategies = true;
+
+// If a successful child stopped reading its input early, immediately try a
+// candidate with everything it didn't read removed.
+gboolean kTruncateConsumed = true;
+
 // Increase for more debugging messages.
 guint kVerbosity = 0;
 
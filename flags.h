@@ -29,6 +29,8 @@
 
 // See flags.c for documentation.
 extern guint kMaxUnprocessed;
+extern gboolean kAdaptiveQueue;
+extern gint64 kMaxSpeculativeBytes;
 extern guint kCleanupThreads;
 extern guint kProcessThreads;
 extern guint kWorkerPollDelay;
@@ -43,6 +45,8 @@ extern gboolean kGenerateDotFile;
 extern gboolean kSimplifyDotFile;
 extern gboolean kContinueSearch;
 extern gboolean kIterateUntilStable;
+extern gboolean kOverlapStrategies;
+extern gboolean kTruncateConsumed;
 extern guint kVerbosity;
 extern gboolean kQuiet;
 extern gboolean kGenerateIntermediateFile;
@@ -37,6 +37,8 @@
 #include "tree.h"
 #include "limits.h"
 #include "flags.h"
+#include "storage.h"
+#include "plugin.h"
 
 // This file is part of halfempty - a fast, parallel testcase minimization tool.
 //
@@ -63,8 +65,20 @@ static const GOptionEntry kThreadOptions[] = {
         "threads" },
     { "max-queue", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
         &kMaxUnprocessed,
-        "Maximum number of unprocessed workunits (default=4).",
+        "Initial number of unprocessed workunits, and the limit if above num-threads (default=2).",
         "N" },
+    { "fixed-queue", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,
+        &kAdaptiveQueue,
+        "Don't tune the number of unprocessed workunits (default=adaptive).",
+        NULL },
+    { "max-spec-bytes", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT64,
+        &kMaxSpeculativeBytes,
+        "Maximum bytes held by unprocessed workunits (default=unlimited).",
+        "bytes" },
+    { "storage", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_CALLBACK,
+        decode_storage_backend,
+        "Where to keep the output before it's saved, one of tmp, memfd, dir:PATH, reflink or heap (default=tmp).",
+        "backend" },
     { "poll-delay", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
         &kWorkerPollDelay,
         "How long to sleep between checking queue status (default=10000).",
@@ -129,6 +143,14 @@ static const GOptionEntry kStandardOptions[] = {
         &kIterateUntilStable,
         "Re-run strategies until the result is stable (default=false).",
         NULL },
+    { "no-overlap", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,
+        &kOverlapStrategies,
+        "Wait for each strategy to finish before starting the next (default=overlap).",
+        NULL },
+    { "no-truncate", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,
+        &kTruncateConsumed,
+        "Don't remove data a successful child didn't read (default=truncate).",
+        NULL },
     { "quiet", 'q', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kQuiet,
         "Minimize all messages, only print errors (default=false).",
         NULL },
@@ -214,10 +236,18 @@ int main(int argc, char **argv)
     context = g_option_context_new("SCRIPT INPUTFILE");
 
     g_option_context_add_main_entries (context, kStandardOptions, NULL);
+    g_option_context_add_main_entries (context, kPluginOptions, NULL);
     g_option_context_add_group(context, threadopts);
     g_option_context_add_group(context, debugopts);
     g_option_context_add_group(context, procopts);
 
+    // Plugins can add strategies with their own options, so they have to be
+    // loaded first.
+    if (load_strategy_plugins(argc, argv) == false) {
+        g_message("loading strategy plugins failed, see --help for information");
+        return EXIT_FAILURE;
+    }
+
     // Initialize strategy specific options.
     g_info("Initializing %u strategies...", kNumStrategies);
     for (gint k = 0; k < kNumStrategies; k++) {
@@ -306,43 +336,16 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    // Begin minimization.
-    while (true) {
-        // Record original size.
-        gsize originalsize = g_file_size(fd);
-
-        // Iterate over all available strategies.
-        for (gint k = 0; k < kNumStrategies; k++) {
-            g_print("Input file \"%s\" is now %lu bytes, starting strategy \"%s\"...",
-                    kInputFile,
-                    g_file_size(fd),
-                    kStrategyList[k].name);
-
-            if (build_bisection_tree(fd,
-                                     kStrategyList[k].callback,
-                                     &fd,
-                                     BISECT_FLAG_CLOSEINPUT) == false) {
-                g_warning("Strategy \"%s\" failed, cannot continue.",
-                          kStrategyList[k].name);
-                return EXIT_FAILURE;
-            }
-
-            g_print("");
-
-            g_print("Strategy \"%s\" complete, output %lu bytes",
-                    kStrategyList[k].name,
-                    g_file_size(fd));
-        }
+    // Begin minimization, all strategies are run in a single tree so that
+    // work for the next strategy can start before the previous one finishes.
+    g_print("Input file \"%s\" is %lu bytes, starting strategy \"%s\"...",
+            kInputFile,
+            g_file_size(fd),
+            kStrategyList[0].name);
 
-        if (kIterateUntilStable && g_file_size(fd) < originalsize) {
-            g_print("Minimization succeeded, testing if minimization is stable...\n");
-            continue;
-        } else if (kIterateUntilStable) {
-            g_print("Minimization stable, all work done.\n");
-        }
-
-        // All done.
-        break;
+    if (build_bisection_tree(fd, &fd, BISECT_FLAG_CLOSEINPUT) == false) {
+        g_warning("Minimization failed, cannot continue.");
+        return EXIT_FAILURE;
     }
 
     g_print("All work complete, generating output %s (size: %lu)",
@@ -350,9 +353,9 @@ int main(int argc, char **argv)
             g_file_size(fd));
 
     output = g_open(kOutputFile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-    g_sendfile_all(output, fd, 0, g_file_size(fd));
+    storage_copy(output, fd, 0, g_file_size(fd));
     g_close(output, NULL);
-    g_close(fd, NULL);
+    storage_release(fd);
     g_option_context_free(context);
     return EXIT_SUCCESS;
 }
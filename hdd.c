@@ -0,0 +1,363 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "hdd"
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// Hierarchical delta debugging. We find the structure of the data from
+// balanced brackets (or indentation), and then try to remove whole elements,
+// starting with the outermost level and working inwards. Removing a complete
+// element is much more likely to leave a valid file than an arbitrary range.
+//
+// Within a level this works like bisect.c, but counts elements instead of
+// bytes, so candidates for a level are emitted as a chain and tested in
+// parallel. When we reach the end of a level we move on to the next one.
+//
+// The hierarchy is found once per source, we remember the most recent one.
+//
+
+// The structure of our user data.
+typedef struct {
+    guint   level;
+    gsize   offset;
+    gsize   chunksize;
+} hdd_t;
+
+// An element of the hierarchy.
+typedef struct {
+    gsize   start;
+    gsize   end;
+    guint   depth;
+} element_t;
+
+// Configurable Knobs.
+static gboolean kHddEnabled = false;
+static gchar *kHddBrackets = "{}[]()";
+static gboolean kHddIndent = false;
+
+static const GOptionEntry kHddOptions[] = {
+    { "hdd", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kHddEnabled,
+        "Remove nested elements level by level before the other strategies.",
+        NULL },
+    { "hdd-brackets", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &kHddBrackets,
+        "Pairs of opening and closing characters that nest (default={}[]()).",
+        "pairs" },
+    { "hdd-indent", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kHddIndent,
+        "Elements are lines, and nest by indentation rather than brackets.",
+        NULL },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Remove nested elements level by level, outermost first";
+
+// The most recent hierarchy, and the extents it was created from. We hold a
+// reference to the extents so the pointer can't be reused.
+static GArray *hierarchyextents;
+static GArray *hierarchy;       // Elements, sorted by depth and then start.
+static GArray *levels;          // Index of the first element of each depth.
+
+// Order elements by depth, and then position.
+static gint compare_elements(gconstpointer a, gconstpointer b)
+{
+    const element_t *x = a;
+    const element_t *y = b;
+
+    if (x->depth != y->depth)
+        return (x->depth > y->depth) - (x->depth < y->depth);
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// The contents of every matched pair of brackets is an element. We keep the
+// brackets themselves, removing them usually leaves a syntax error behind,
+// but an empty container is usually valid.
+static void find_bracket_elements(GArray *elements, const guchar *data, gsize size)
+{
+    GArray  *stack = g_array_new(false, false, sizeof(gsize));
+    gint     closer[256];
+    gboolean closes[256] = { false };
+
+    memset(closer, -1, sizeof closer);
+
+    for (const gchar *p = kHddBrackets; p[0] && p[1]; p += 2) {
+        closer[(guchar) p[0]] = (guchar) p[1];
+        closes[(guchar) p[1]] = true;
+    }
+
+    for (gsize i = 0; i < size; i++) {
+        // If this closes a bracket on the stack, that's an element. Any
+        // brackets opened after it were never closed, so we drop them rather
+        // than let them hide every enclosing pair.
+        if (closes[data[i]]) {
+            gint depth;
+
+            for (depth = stack->len - 1; depth >= 0; depth--) {
+                if (closer[data[g_array_index(stack, gsize, depth)]] == data[i])
+                    break;
+            }
+
+            if (depth >= 0) {
+                element_t element = {
+                    .start  = g_array_index(stack, gsize, depth) + 1,
+                    .end    = i,
+                    .depth  = depth,
+                };
+
+                if (element.end > element.start) {
+                    g_array_append_val(elements, element);
+                }
+
+                g_array_set_size(stack, depth);
+                continue;
+            }
+        }
+
+        if (closer[data[i]] != -1) {
+            g_array_append_val(stack, i);
+        }
+    }
+
+    g_array_unref(stack);
+}
+
+// Every line is an element, containing the following lines that are indented
+// more than it is.
+static void find_indent_elements(GArray *elements, const guchar *data, gsize size)
+{
+    GArray *stack = g_array_new(false, false, sizeof(element_t));
+    gsize   indent;
+    gsize   i;
+
+    for (gsize line = 0; line < size; line = i) {
+        // Measure the indentation.
+        for (i = line; i < size && (data[i] == ' ' || data[i] == '\t'); i++)
+            ;
+
+        indent = i - line;
+
+        // Find the start of the next line.
+        for (; i < size && data[i] != '\n'; i++)
+            ;
+
+        if (i < size)
+            i++;
+
+        // Blank lines belong to whatever they're inside.
+        if (i - line - indent <= 1)
+            continue;
+
+        // This line ends any element indented at least as much. We reuse
+        // depth to hold the indentation while they're on the stack.
+        while (stack->len > 0) {
+            element_t *top = &g_array_index(stack, element_t, stack->len - 1);
+
+            if (top->depth < indent)
+                break;
+
+            top->end    = line;
+            top->depth  = stack->len - 1;
+            g_array_append_val(elements, *top);
+            g_array_set_size(stack, stack->len - 1);
+        }
+
+        g_array_append_val(stack, ((element_t) { line, size, indent }));
+    }
+
+    while (stack->len > 0) {
+        element_t *top = &g_array_index(stack, element_t, stack->len - 1);
+
+        top->depth = stack->len - 1;
+        g_array_append_val(elements, *top);
+        g_array_set_size(stack, stack->len - 1);
+    }
+
+    g_array_unref(stack);
+}
+
+// Return the hierarchy for this data, creating it if necessary.
+// XXX: must hold tree lock.
+static void update_hierarchy(GArray *extents)
+{
+    gsize   size;
+    guchar *data;
+
+    if (hierarchyextents == extents)
+        return;
+
+    if (hierarchyextents) {
+        g_array_unref(hierarchyextents);
+        g_array_unref(hierarchy);
+        g_array_unref(levels);
+    }
+
+    size             = extent_size(extents);
+    data             = g_malloc(size);
+    hierarchyextents = g_array_ref(extents);
+    hierarchy        = g_array_new(false, false, sizeof(element_t));
+    levels           = g_array_new(false, false, sizeof(guint));
+
+    extent_read(extents, data, size, 0);
+
+    if (kHddIndent) {
+        find_indent_elements(hierarchy, data, size);
+    } else {
+        find_bracket_elements(hierarchy, data, size);
+    }
+
+    g_array_sort(hierarchy, compare_elements);
+
+    // Record where each level starts, with a final entry for the end.
+    for (guint i = 0; i < hierarchy->len; i++) {
+        while (levels->len <= g_array_index(hierarchy, element_t, i).depth) {
+            g_array_append_val(levels, i);
+        }
+    }
+
+    g_array_append_val(levels, hierarchy->len);
+
+    g_debug("found %u elements in %u levels", hierarchy->len, levels->len - 1);
+
+    g_free(data);
+}
+
+// Number of elements at this level of the current hierarchy.
+static gsize level_size(guint level)
+{
+    if (level + 1 >= levels->len)
+        return 0;
+
+    return g_array_index(levels, guint, level + 1)
+         - g_array_index(levels, guint, level);
+}
+
+static task_t * strategy_hdd_data(GNode *node)
+{
+    task_t  *child  = NULL;             // The new task we're about to return.
+    task_t  *parent = node->data;       // The task above us in the tree.
+    task_t  *source;                    // Where we get our data from.
+    GArray  *extents;
+    gsize    count;
+
+    // We don't hold the lock on parent, but user data will never change.
+    hdd_t   *parentstatus = parent->user;
+    hdd_t   *childstatus;
+
+    g_debug("strategy_hdd_data(%p)", node);
+
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
+        if (kHddEnabled == false)
+            return NULL;
+
+        g_mutex_lock(&parent->mutex);
+        update_hierarchy(parent->extents);
+        g_mutex_unlock(&parent->mutex);
+
+        // Nothing to do if there's no structure.
+        if (level_size(0) == 0)
+            return NULL;
+
+        childstatus             = task_user_new(parent, sizeof(hdd_t));
+        childstatus->level      = 0;
+        childstatus->offset     = 0;
+        childstatus->chunksize  = level_size(0);
+        return parent;
+    }
+
+    // Initialize child from parent.
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+    childstatus     = task_user_new(child, sizeof(hdd_t));
+
+    memcpy(childstatus, parentstatus, sizeof(hdd_t));
+
+    source = g_node_source_task(node);
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    update_hierarchy(source->extents);
+
+    // If the parent succeeded, the elements we tried are gone and the next
+    // ones are already at offset. Otherwise, try the next chunk.
+    if (g_node_strategy_status(node) != TASK_STATUS_SUCCESS) {
+        childstatus->offset += childstatus->chunksize;
+    }
+
+    // Find the next level and chunk that has something to remove.
+    while ((count = level_size(childstatus->level)) <= childstatus->offset) {
+        childstatus->offset      = 0;
+        childstatus->chunksize >>= 1;
+
+        if (childstatus->chunksize == 0) {
+            // This level is complete, move on to the next one.
+            if (++childstatus->level >= levels->len - 1) {
+                g_info("final level complete.");
+                goto nochildunlock;
+            }
+
+            childstatus->chunksize = level_size(childstatus->level);
+
+            g_info("starting level %u, %lu elements",
+                   childstatus->level,
+                   childstatus->chunksize);
+        }
+    }
+
+    // Remove each element in the chunk, starting from the end so that the
+    // earlier offsets are still correct.
+    extents = g_array_ref(source->extents);
+
+    for (gsize i = MIN(childstatus->offset + childstatus->chunksize, count);
+         i-- > childstatus->offset;) {
+        element_t *element = &g_array_index(hierarchy,
+                                             element_t,
+                                             g_array_index(levels,
+                                                           guint,
+                                                           childstatus->level) + i);
+        GArray    *result  = extent_delete(extents,
+                                           element->start,
+                                           element->end - element->start);
+        g_array_unref(extents);
+        extents = result;
+    }
+
+    child->extents = extents;
+    child->size    = extent_size(child->extents);
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+
+  nochildunlock:
+    g_mutex_unlock(&source->mutex);
+    task_free(child);
+    return NULL;
+}
+
+// Add this strategy to the global list.
+REGISTER_STRATEGY(hdd, kDescription, kHddOptions, strategy_hdd_data);
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "lines"
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// This is the same algorithm as bisect.c, but instead of removing arbitrary
+// byte ranges we remove whole units, by default lines. For text formats most
+// byte ranges cut a token in half and fail, so this can remove most of the
+// file in far fewer tests, and bisect can then work on what's left.
+//
+// The offset and chunksize are counted in units of the source data. We find
+// where the units start once per source, and remember the most recent one.
+//
+
+// The structure of our user data.
+typedef struct {
+    gsize   offset;
+    gsize   chunksize;
+} lines_t;
+
+// Configurable Knobs.
+static gboolean kLinesEnabled = false;
+static gchar *kLinesDelimiters = "\\n";
+static gchar *kLinesRegex = NULL;
+
+static const GOptionEntry kLinesOptions[] = {
+    { "lines", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kLinesEnabled,
+        "Remove whole lines (or tokens) before trying byte ranges.",
+        NULL },
+    { "lines-delimiters", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+        &kLinesDelimiters,
+        "Every one of these characters ends a unit, C escapes are allowed (default=\\n).",
+        "chars" },
+    { "lines-regex", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &kLinesRegex,
+        "Each match of this regex is a unit, overrides --lines-delimiters.",
+        "regex" },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Remove consecutively larger chunks of lines or tokens from the file";
+
+// The most recent unit index, and the extents it was created from. We hold a
+// reference to the extents so the pointer can't be reused.
+static GArray *indexextents;
+static GArray *unitindex;
+
+// The compiled --lines-regex, if specified.
+static GRegex *unitregex;
+
+// Add a unit boundary, ignoring duplicates.
+static void append_boundary(GArray *index, gsize offset)
+{
+    if (index->len == 0 || g_array_index(index, gsize, index->len - 1) < offset) {
+        g_array_append_val(index, offset);
+    }
+}
+
+// Create a list of the offsets where every unit starts in this data, followed
+// by the total size. A file with n units has n + 1 entries.
+static GArray * build_unit_index(GArray *extents)
+{
+    GArray  *index  = g_array_new(false, false, sizeof(gsize));
+    gsize    size   = extent_size(extents);
+    guchar  *data   = g_malloc(size);
+    gboolean delimiter[256] = { false };
+    GMatchInfo *match;
+    gint     start;
+    gint     end;
+
+    extent_read(extents, data, size, 0);
+    append_boundary(index, 0);
+
+    if (unitregex) {
+        // Every match starts and ends a unit, anything in between is a unit
+        // too.
+        g_regex_match_full(unitregex, (gchar *) data, size, 0, 0, &match, NULL);
+
+        while (g_match_info_matches(match)) {
+            g_match_info_fetch_pos(match, 0, &start, &end);
+            append_boundary(index, start);
+            append_boundary(index, end);
+            g_match_info_next(match, NULL);
+        }
+
+        g_match_info_free(match);
+    } else {
+        gchar *chars = g_strcompress(kLinesDelimiters);
+
+        for (gchar *c = chars; *c; c++) {
+            delimiter[(guchar) *c] = true;
+        }
+
+        for (gsize i = 0; i < size; i++) {
+            if (delimiter[data[i]]) {
+                append_boundary(index, i + 1);
+            }
+        }
+
+        g_free(chars);
+    }
+
+    append_boundary(index, size);
+
+    g_free(data);
+
+    g_debug("found %u units in %lu bytes", index->len - 1, size);
+
+    return index;
+}
+
+// Return the unit index for this data, creating it if necessary.
+// XXX: must hold tree lock.
+static GArray * get_unit_index(GArray *extents)
+{
+    if (indexextents != extents) {
+        if (indexextents) {
+            g_array_unref(indexextents);
+            g_array_unref(unitindex);
+        }
+
+        indexextents = g_array_ref(extents);
+        unitindex    = build_unit_index(extents);
+    }
+
+    return unitindex;
+}
+
+static task_t * strategy_lines_data(GNode *node)
+{
+    task_t  *child  = NULL;             // The new task we're about to return.
+    task_t  *parent = node->data;       // The task above us in the tree.
+    task_t  *source;                    // Where we get our data from.
+    GArray  *index;
+    gsize    units;
+    gsize    start;
+    gsize    end;
+
+    // We don't hold the lock on parent, but user data will never change.
+    lines_t *parentstatus = parent->user;
+    lines_t *childstatus;
+
+    g_debug("strategy_lines_data(%p)", node);
+
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
+        GError *error = NULL;
+
+        // This strategy is only useful for text, so it must be requested.
+        if (kLinesEnabled == false)
+            return NULL;
+
+        if (kLinesRegex && unitregex == NULL) {
+            unitregex = g_regex_new(kLinesRegex,
+                                    G_REGEX_RAW | G_REGEX_OPTIMIZE,
+                                    0,
+                                    &error);
+
+            if (unitregex == NULL) {
+                g_warning("failed to compile --lines-regex, %s", error->message);
+                g_clear_error(&error);
+                kLinesEnabled = false;
+                return NULL;
+            }
+        }
+
+        g_mutex_lock(&parent->mutex);
+        units = get_unit_index(parent->extents)->len - 1;
+        g_mutex_unlock(&parent->mutex);
+
+        g_debug("initializing a new root node, %lu units", units);
+
+        // There's no point if there's only one unit, bisect can handle it.
+        if (units <= 1)
+            return NULL;
+
+        childstatus             = task_user_new(parent, sizeof(lines_t));
+        childstatus->offset     = 0;
+        childstatus->chunksize  = units;
+        return parent;
+    }
+
+    // Initialize child from parent.
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+    childstatus     = task_user_new(child, sizeof(lines_t));
+
+    memcpy(childstatus, parentstatus, sizeof(lines_t));
+
+    source = g_node_source_task(node);
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    index = get_unit_index(source->extents);
+    units = index->len - 1;
+
+    // If the parent succeeded, the chunk we tried is gone and the next one is
+    // already at offset. Otherwise, try the next chunk.
+    if (g_node_strategy_status(node) != TASK_STATUS_SUCCESS) {
+        childstatus->offset += childstatus->chunksize;
+    }
+
+    // Check if we've finished a chunksize.
+    if (childstatus->offset >= units) {
+        g_info("reached end of cycle (offset %lu, chunksize %lu, units %lu)",
+               childstatus->offset,
+               childstatus->chunksize,
+               units);
+
+        childstatus->offset       = 0;
+        childstatus->chunksize  >>= 1;
+    }
+
+    if (childstatus->chunksize == 0 || units == 0) {
+        g_info("final cycle complete.");
+        goto nochildunlock;
+    }
+
+    start = g_array_index(index, gsize, childstatus->offset);
+    end   = g_array_index(index, gsize, MIN(childstatus->offset
+                                                + childstatus->chunksize,
+                                            units));
+
+    child->extents = extent_delete(source->extents, start, end - start);
+    child->size    = extent_size(child->extents);
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+
+  nochildunlock:
+    g_mutex_unlock(&source->mutex);
+    task_free(child);
+    return NULL;
+}
+
+// Add this strategy to the global list.
+REGISTER_STRATEGY(lines, kDescription, kLinesOptions, strategy_lines_data);
@@ -0,0 +1,272 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "offset"
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// Binary formats are full of lengths and offsets, and removing data they
+// refer to usually breaks the file. This strategy guesses that a field is a
+// length or offset, lowers it, and deletes the same number of bytes just
+// before the point it refers to, so it still points at the same data.
+//
+// A field can be a length (relative to the end of the field) or an absolute
+// offset, of 1, 2 or 4 bytes in either byte order. Either way, it spans the
+// data between the end of the field and the point it refers to. For each
+// interpretation we try removing everything it spans, then half as much.
+// Almost any byte looks like a plausible 1 byte field, so those are never
+// halved.
+//
+// That's still up to 18 candidates for every byte of the input, so this is
+// slow and best used on small files.
+//
+// Each candidate is an independent guess, so as a chain of predicted failures
+// the workers can test them in parallel. If one works, we try the same guess
+// again with the new value.
+//
+
+// How a field might be encoded.
+typedef struct {
+    guint       width;
+    gboolean    bigendian;
+    gboolean    relative;
+} field_t;
+
+static const field_t kFields[] = {
+    { 1, false, true  },
+    { 1, false, false },
+    { 2, false, true  },
+    { 2, false, false },
+    { 2, true,  true  },
+    { 2, true,  false },
+    { 4, false, true  },
+    { 4, false, false },
+    { 4, true,  true  },
+    { 4, true,  false },
+};
+
+// The structure of our user data.
+typedef struct {
+    gsize   position;   // Where the field starts.
+    guint   field;      // Index into kFields.
+    guint   shift;      // We remove span >> shift bytes.
+} offset_t;
+
+// We only try removing the whole span, or half of it.
+static const guint kMaxShift = 1;
+
+// Configurable Knobs.
+static gboolean kOffsetEnabled = false;
+static gint kOffsetMaxWidth = 4;
+
+static const GOptionEntry kOffsetOptions[] = {
+    { "offset", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kOffsetEnabled,
+        "Try lowering lengths and offsets with the data they refer to. "
+        "Tests up to 18 candidates per input byte, so is slow on large files.",
+        NULL },
+    { "offset-max-width", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+        &kOffsetMaxWidth,
+        "Largest field to consider in bytes, 1, 2 or 4 (default=4).",
+        "bytes" },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Lower length and offset fields and remove the data they span";
+
+static guint32 decode_field(const field_t *field, const guchar *data)
+{
+    guint32 value = 0;
+
+    for (guint i = 0; i < field->width; i++) {
+        guint shift = field->bigendian ? field->width - 1 - i : i;
+
+        value |= (guint32) data[i] << (shift * 8);
+    }
+
+    return value;
+}
+
+// Move status forward to the next guess that makes sense for this data,
+// including the current one. The range to remove and the new field value are
+// returned. Returns false if there are none left.
+static gboolean find_candidate(offset_t *status,
+                               GArray *extents,
+                               gsize size,
+                               gsize *start,
+                               gsize *length,
+                               guint32 *newvalue)
+{
+    guchar  data[4];
+    gsize   count = 0;
+    gsize   loaded = G_MAXSIZE;
+
+    while (status->position < size) {
+        const field_t *field;
+        guint32 value;
+        gsize   end;
+        gsize   span;
+
+        if (status->field == G_N_ELEMENTS(kFields)) {
+            status->position++;
+            status->field = 0;
+            status->shift = 0;
+            continue;
+        }
+
+        field = &kFields[status->field];
+
+        // Only read the data once per position.
+        if (loaded != status->position) {
+            count  = extent_read(extents, data, sizeof data, status->position);
+            loaded = status->position;
+        }
+
+        if (field->width > (guint) kOffsetMaxWidth || field->width > count)
+            goto nextfield;
+
+        value = decode_field(field, data);
+        end   = (field->relative ? status->position + field->width : 0) + value;
+
+        // It has to refer to something after the field, and inside the data.
+        if (value == 0 || end > size || end <= status->position + field->width)
+            goto nextfield;
+
+        span = end - (status->position + field->width);
+
+        // We've tried every size of removal.
+        if (status->shift > kMaxShift || (span >> status->shift) == 0)
+            goto nextfield;
+
+        // Single bytes are too common to halve.
+        if (field->width == 1 && status->shift > 0)
+            goto nextfield;
+
+        // Whether it's a length or an offset, the target moves down by as
+        // much as we remove.
+        *length     = span >> status->shift;
+        *start      = end - *length;
+        *newvalue   = value - *length;
+
+        return true;
+
+      nextfield:
+        status->field++;
+        status->shift = 0;
+    }
+
+    return false;
+}
+
+static task_t * strategy_offset_data(GNode *node)
+{
+    task_t   *child  = NULL;            // The new task we're about to return.
+    task_t   *parent = node->data;      // The task above us in the tree.
+    task_t   *source;                   // Where we get our data from.
+    GArray   *extents;
+    gsize     start;
+    gsize     length;
+    guint32   value;
+
+    // We don't hold the lock on parent, but user data will never change.
+    offset_t *parentstatus = parent->user;
+    offset_t *childstatus;
+
+    g_debug("strategy_offset_data(%p)", node);
+
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
+        if (kOffsetEnabled == false || parent->size < 2)
+            return NULL;
+
+        task_user_new(parent, sizeof(offset_t));
+        return parent;
+    }
+
+    // Initialize child from parent.
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+    childstatus     = task_user_new(child, sizeof(offset_t));
+
+    memcpy(childstatus, parentstatus, sizeof(offset_t));
+
+    // If the parent worked, the same guess might work again with the new
+    // value. Otherwise move on to the next one.
+    if (g_node_strategy_root(node) == false
+     && g_node_strategy_status(node) != TASK_STATUS_SUCCESS) {
+        childstatus->shift++;
+    }
+
+    source = g_node_source_task(node);
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    if (find_candidate(childstatus,
+                       source->extents,
+                       source->size,
+                       &start,
+                       &length,
+                       &value) == false) {
+        g_info("final field complete");
+        goto nochildunlock;
+    }
+
+    g_debug("field %u at %lu, removing %lu bytes at %lu",
+            childstatus->field,
+            childstatus->position,
+            length,
+            start);
+
+    // The removal is after the field, so do it first.
+    extents = extent_delete(source->extents, start, length);
+
+    for (guint i = 0; i < kFields[childstatus->field].width; i++) {
+        guint   width   = kFields[childstatus->field].width;
+        guint   shift   = kFields[childstatus->field].bigendian ? width - 1 - i : i;
+        GArray *result  = extent_fill(extents,
+                                      childstatus->position + i,
+                                      1,
+                                      (value >> (shift * 8)) & 0xff);
+
+        g_array_unref(extents);
+        extents = result;
+    }
+
+    child->extents = extents;
+    child->size    = extent_size(child->extents);
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+
+  nochildunlock:
+    g_mutex_unlock(&source->mutex);
+    task_free(child);
+    return NULL;
+}
+
+// Add this strategy to the global list.
+REGISTER_STRATEGY(offset, kDescription, kOffsetOptions, strategy_offset_data);
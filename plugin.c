@@ -0,0 +1,154 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "plugin.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// Load additional strategies from shared objects. A plugin registers its
+// strategies with REGISTER_STRATEGY() exactly like the builtin ones, but the
+// constructors that run when we dlopen() it only fill in a table inside the
+// plugin. We copy that table once we know its layout matches ours. The binary
+// is linked with -rdynamic, so plugins can use the same task, tree and extent
+// functions.
+//
+// This has to happen before the commandline is parsed, so that the options
+// for plugin strategies are recognized.
+//
+
+// Shared objects to load strategies from.
+static gchar **kStrategyPlugins;
+
+const GOptionEntry kPluginOptions[] = {
+    { "strategy-plugin", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME_ARRAY,
+        &kStrategyPlugins,
+        "Load more strategies from this shared object, can be repeated.",
+        "file.so" },
+    { NULL },
+};
+
+// Number of strategies that came from plugins, these are at the start of
+// kStrategyList.
+static gint pluginstrategies;
+
+static gboolean load_strategy_plugin(const gchar *filename)
+{
+    const strategy_abi_t *abi;
+    const strategy_t     *strategies;
+    const gint           *count;
+    gpointer              handle;
+    gchar                *path;
+
+    // dlopen() searches the library path for a name without a slash, but
+    // users will expect a file in the current directory.
+    if (strchr(filename, '/')) {
+        path = g_strdup(filename);
+    } else {
+        path = g_build_filename(".", filename, NULL);
+    }
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    g_free(path);
+
+    if (handle == NULL) {
+        g_warning("failed to load strategy plugin %s, %s", filename, dlerror());
+        return false;
+    }
+
+    abi         = dlsym(handle, "halfempty_strategy_abi");
+    strategies  = dlsym(handle, "halfempty_strategies");
+    count       = dlsym(handle, "halfempty_num_strategies");
+
+    // Don't look at the table until we know it's laid out like ours.
+    if (abi == NULL
+     || strategies == NULL
+     || count == NULL
+     || abi->version != STRATEGY_ABI_VERSION
+     || abi->tasksize != sizeof(task_t)
+     || abi->strategysize != sizeof(strategy_t)) {
+        g_warning("strategy plugin %s was not built for this version of halfempty",
+                  filename);
+        dlclose(handle);
+        return false;
+    }
+
+    if (*count == 0) {
+        g_warning("strategy plugin %s did not register any strategies", filename);
+        dlclose(handle);
+        return false;
+    }
+
+    if (kNumStrategies + *count >= MAX_STRATEGIES) {
+        g_warning("strategy plugin %s registered too many strategies", filename);
+        dlclose(handle);
+        return false;
+    }
+
+    // Plugins know the most about the format, so they run before the builtin
+    // strategies, in the order they were loaded.
+    memmove(&kStrategyList[pluginstrategies + *count],
+            &kStrategyList[pluginstrategies],
+            (kNumStrategies - pluginstrategies) * sizeof(strategy_t));
+    memcpy(&kStrategyList[pluginstrategies], strategies, *count * sizeof(strategy_t));
+
+    kNumStrategies   += *count;
+    pluginstrategies += *count;
+
+    g_debug("loaded %d strategies from plugin %s", *count, filename);
+
+    return true;
+}
+
+// Find any --strategy-plugin options and load them, everything else is left
+// for the real parser.
+gboolean load_strategy_plugins(gint argc, gchar **argv)
+{
+    GOptionContext *context = g_option_context_new(NULL);
+    gchar   **args    = g_new0(gchar *, argc + 1);
+    gboolean  result  = true;
+
+    // The parser modifies the array, so give it a copy.
+    memcpy(args, argv, argc * sizeof(gchar *));
+
+    g_option_context_set_ignore_unknown_options(context, true);
+    g_option_context_set_help_enabled(context, false);
+    g_option_context_add_main_entries(context, kPluginOptions, NULL);
+
+    if (g_option_context_parse(context, &argc, &args, NULL) == false) {
+        result = false;
+    }
+
+    for (gchar **plugin = kStrategyPlugins; result && plugin && *plugin; plugin++) {
+        result = load_strategy_plugin(*plugin);
+    }
+
+    // The real parser will set this again.
+    g_strfreev(kStrategyPlugins);
+
+    kStrategyPlugins = NULL;
+
+    g_option_context_free(context);
+    g_free(args);
+    return result;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PLUGIN_H
+#define __PLUGIN_H
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+
+extern const GOptionEntry kPluginOptions[];
+
+gboolean load_strategy_plugins(gint argc, gchar **argv);
+
+#else
+# warning plugin.h included twice
+#endif
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "probdd"
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// Probabilistic delta debugging. The data is split into chunks, and we keep an
+// estimate of the probability that each chunk is required. Every candidate
+// removes the set of least likely chunks that maximizes the expected number
+// of bytes removed.
+//
+//  * If the candidate works, those chunks are gone.
+//  * If it fails, at least one of them must have been required, so their
+//    probabilities increase. A single chunk that fails is definitely required.
+//
+// The model for a node is derived from its parent, assuming the parent failed
+// unless we know it succeeded. That's the same prediction the tree makes, so
+// a chain of candidates can be tested in parallel.
+//
+
+// Per-chunk model.
+typedef struct {
+    gfloat  probability;    // Estimated probability this chunk is required.
+    guint8  flags;
+} chunk_t;
+
+#define CHUNK_REMOVED   (1 << 0)    // Removed by a successful ancestor.
+#define CHUNK_TRIED     (1 << 1)    // Removed by this candidate.
+
+// The structure of our user data.
+typedef struct {
+    gsize   size;       // Size of the data when the strategy started.
+    guint   count;      // Number of chunks.
+    chunk_t chunks[];
+} probdd_t;
+
+// Configurable Knobs.
+static gboolean kProbddEnabled = false;
+static gint kProbddChunks = 256;
+static gdouble kProbddInitial = 0.1;
+
+static const GOptionEntry kProbddOptions[] = {
+    { "probdd", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kProbddEnabled,
+        "Run probabilistic delta debugging before the other strategies.",
+        NULL },
+    { "probdd-chunks", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &kProbddChunks,
+        "Split the data into this many chunks (default=256).",
+        "chunks" },
+    { "probdd-initial", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+        &kProbddInitial,
+        "Initial probability that a chunk is required (default=0.1).",
+        "probability" },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Remove the chunks least likely to be required, learning from failures";
+
+static gsize probdd_size(guint count)
+{
+    return sizeof(probdd_t) + sizeof(chunk_t) * count;
+}
+
+// Byte range of chunk i in the original data.
+static gsize chunk_start(const probdd_t *status, guint i)
+{
+    return i * status->size / status->count;
+}
+
+// Sort chunk indexes by probability, keeping the original order for ties so
+// results are reproducible.
+static gint compare_chunks(gconstpointer a, gconstpointer b, gpointer user)
+{
+    const probdd_t *status = user;
+    guint x = *(const guint *) a;
+    guint y = *(const guint *) b;
+    gfloat px = status->chunks[x].probability;
+    gfloat py = status->chunks[y].probability;
+
+    if (px != py)
+        return (px > py) - (px < py);
+
+    return (x > y) - (x < y);
+}
+
+// Choose the chunks for the next candidate, returns the number chosen.
+static guint choose_chunks(probdd_t *status)
+{
+    GArray  *order = g_array_new(false, false, sizeof(guint));
+    gdouble  keep  = 1.0;       // Probability none of the chosen are required.
+    gdouble  best  = 0.0;
+    guint    count = 0;
+
+    for (guint i = 0; i < status->count; i++) {
+        if (status->chunks[i].flags & CHUNK_REMOVED)
+            continue;
+        if (status->chunks[i].probability >= 1.0)
+            continue;
+
+        g_array_append_val(order, i);
+    }
+
+    g_array_sort_with_data(order, compare_chunks, status);
+
+    // Take the prefix that maximizes the expected number of chunks removed.
+    for (guint i = 0; i < order->len; i++) {
+        keep *= 1.0 - status->chunks[g_array_index(order, guint, i)].probability;
+
+        if ((i + 1) * keep > best) {
+            best  = (i + 1) * keep;
+            count = i + 1;
+        }
+    }
+
+    for (guint i = 0; i < count; i++) {
+        status->chunks[g_array_index(order, guint, i)].flags |= CHUNK_TRIED;
+    }
+
+    g_array_unref(order);
+    return count;
+}
+
+// The source might have been truncated since the chunks were laid out, any
+// chunk that now starts past the end is already gone.
+static void remove_truncated_chunks(probdd_t *status, gsize size)
+{
+    gsize removed = 0;
+
+    for (guint i = 0; i < status->count; i++) {
+        chunk_t *chunk  = &status->chunks[i];
+        gsize    start  = chunk_start(status, i);
+        gsize    length = chunk_start(status, i + 1) - start;
+
+        if (!(chunk->flags & CHUNK_REMOVED) && start - removed >= size) {
+            chunk->flags |= CHUNK_REMOVED;
+        }
+
+        if (chunk->flags & CHUNK_REMOVED) {
+            removed += length;
+        }
+    }
+}
+
+// Update the model with the outcome of the parent candidate.
+static void apply_outcome(probdd_t *status, gboolean success)
+{
+    gdouble keep = 1.0;
+
+    for (guint i = 0; i < status->count; i++) {
+        if (status->chunks[i].flags & CHUNK_TRIED) {
+            keep *= 1.0 - status->chunks[i].probability;
+        }
+    }
+
+    for (guint i = 0; i < status->count; i++) {
+        chunk_t *chunk = &status->chunks[i];
+
+        if (!(chunk->flags & CHUNK_TRIED))
+            continue;
+
+        if (success) {
+            chunk->flags |= CHUNK_REMOVED;
+        } else {
+            chunk->probability = MIN(chunk->probability / (1.0 - keep), 1.0);
+        }
+
+        chunk->flags &= ~CHUNK_TRIED;
+    }
+}
+
+static task_t * strategy_probdd_data(GNode *node)
+{
+    task_t   *child  = NULL;            // The new task we're about to return.
+    task_t   *parent = node->data;      // The task above us in the tree.
+    task_t   *source;                   // Where we get our data from.
+    GArray   *extents;
+    gsize     removed;
+
+    // We don't hold the lock on parent, but user data will never change.
+    probdd_t *parentstatus = parent->user;
+    probdd_t *childstatus;
+
+    g_debug("strategy_probdd_data(%p)", node);
+
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
+        guint count = MIN(MAX(kProbddChunks, 1), parent->size);
+
+        if (kProbddEnabled == false || count == 0)
+            return NULL;
+
+        childstatus         = task_user_new(parent, probdd_size(count));
+        childstatus->size   = parent->size;
+        childstatus->count  = count;
+
+        for (guint i = 0; i < count; i++) {
+            childstatus->chunks[i].probability = kProbddInitial;
+        }
+
+        return parent;
+    }
+
+    // Initialize child from parent.
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+    childstatus     = task_user_new(child, probdd_size(parentstatus->count));
+
+    memcpy(childstatus, parentstatus, probdd_size(parentstatus->count));
+
+    apply_outcome(childstatus,
+                  g_node_strategy_status(node) == TASK_STATUS_SUCCESS
+                    && !g_node_strategy_root(node));
+
+    source = g_node_source_task(node);
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    // Don't waste a test on chunks that aren't there.
+    remove_truncated_chunks(childstatus, source->size);
+
+    if (choose_chunks(childstatus) == 0) {
+        g_info("every remaining chunk is required.");
+        g_mutex_unlock(&source->mutex);
+        task_free(child);
+        return NULL;
+    }
+
+    // Find where each chunk is in the source, and remove the ones we chose.
+    // We work from the end, so that earlier offsets are still correct. The
+    // last chunk might have been cut short by a truncation.
+    extents = g_array_ref(source->extents);
+    removed = 0;
+
+    for (guint i = 0; i < childstatus->count; i++) {
+        if (childstatus->chunks[i].flags & CHUNK_REMOVED) {
+            removed += chunk_start(childstatus, i + 1) - chunk_start(childstatus, i);
+        }
+    }
+
+    for (guint i = childstatus->count; i-- > 0;) {
+        chunk_t *chunk  = &childstatus->chunks[i];
+        gsize    start  = chunk_start(childstatus, i);
+        gsize    length = chunk_start(childstatus, i + 1) - start;
+        GArray  *result;
+
+        if (chunk->flags & CHUNK_REMOVED) {
+            removed -= length;
+            continue;
+        }
+
+        if (!(chunk->flags & CHUNK_TRIED))
+            continue;
+
+        // Earlier chunks that were removed have shifted this one down.
+        length = MIN(length, source->size - (start - removed));
+        result = extent_delete(extents, start - removed, length);
+
+        g_array_unref(extents);
+        extents = result;
+    }
+
+    g_assert_cmpuint(removed, ==, 0);
+
+    child->extents = extents;
+    child->size    = extent_size(child->extents);
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+}
+
+// Add this strategy to the global list.
+REGISTER_STRATEGY(probdd, kDescription, kProbddOptions, strategy_probdd_data);
@@ -18,6 +18,7 @@
 #include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <sys/time.h>
+#include <sys/ioctl.h>
 #include <sys/uio.h>
 #include <sys/resource.h>
 #include <sys/types.h>
@@ -33,6 +34,7 @@
 #include <errno.h>
 
 #include "proc.h"
+#include "extent.h"
 #include "flags.h"
 #include "util.h"
 
@@ -72,41 +74,6 @@ static void configure_child_limits(gpointer userdata)
     return;
 }
 
-// Splice data from a file descriptor into a pipe efficiently.
-static gboolean write_pipe(gint pipefd,
-                           gint datafd,
-                           gsize size,
-                           goffset dataoffset,
-                           gboolean closepipe)
-{
-    ssize_t result;
-
-    g_assert_cmpint(pipefd, >, 0);
-    g_assert_cmpint(datafd, >, 0);
-
-    while (size > 0) {
-        result = splice(datafd, &dataoffset, pipefd, NULL, size, 0);
-
-        if (result < 0) {
-            break;
-        } else {
-            size -= result;
-        }
-    }
-
-    if (closepipe) {
-        g_close(pipefd, NULL);
-    }
-
-    // Probably broken pipe? I think this is okay, but should check that's the
-    // real reason
-    if (size != 0) {
-        g_debug("failed to splice all data into pipe, %ld remaining", size);
-    }
-
-    return false;
-}
-
 // Handling timeouts in child processes.
 //
 // It's pretty normal for programs to take too long to process their input, so
@@ -212,13 +179,45 @@ static gpointer timeout_watchdog_thread(gpointer param)
     return NULL;
 }
 
-gint submit_data_subprocess(gint inputfd, gsize inputlen, GPid *childpid)
+// We have to close our end of the pipe so a child waiting for EOF can finish,
+// but then whatever it didn't read is lost with the pipe. Open a read end of
+// the same pipe first, so the unread data stays in the pipe until the child
+// has exited and we've counted it. Returns -1 if that's not possible.
+static gint open_pipe_reader(gint pipefd)
+{
+#ifdef __linux__
+    gchar *path = g_strdup_printf("/proc/self/fd/%d", pipefd);
+    gint   fd   = open(path, O_RDONLY | O_CLOEXEC);
+
+    g_free(path);
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+// Find out how much of the data we wrote into the pipe the child really read,
+// once it has exited. The result is an upper bound, if we can't tell we assume
+// it read everything.
+static gsize count_child_read(gint readerfd, gsize written)
+{
+    gint unread;
+
+    if (readerfd < 0 || ioctl(readerfd, FIONREAD, &unread) != 0 || unread <= 0)
+        return written;
+
+    return written - MIN((gsize) unread, written);
+}
+
+gint submit_data_subprocess(GArray *extents, GPid *childpid, gsize *consumed)
 {
     GError  *error = NULL;
     GThread *watchdog = NULL;
     siginfo_t info = {0};
     watchdog_t timeout;
     gint pipein;
+    gint readerfd;
+    gsize written;
     gint result;
     gint flags;
     gchar **envp;
@@ -281,9 +280,15 @@ gint submit_data_subprocess(gint inputfd, gsize inputlen, GPid *childpid)
 
     g_debug("writing data to child %d pipefd=%d", *childpid, pipein);
 
-    write_pipe(pipein, inputfd, inputlen, 0, true);
+    extent_write_pipe(extents, pipein, &written);
+
+    readerfd = open_pipe_reader(pipein);
+
+    g_close(pipein, NULL);
 
-    g_debug("finished writing data to child, about to waitid(%d)", *childpid);
+    g_debug("finished writing %lu bytes to child, about to waitid(%d)",
+            written,
+            *childpid);
 
   childwait:
     // The data has been written to the child process, now we wait for it to
@@ -304,6 +309,15 @@ gint submit_data_subprocess(gint inputfd, gsize inputlen, GPid *childpid)
 
     g_assert_cmpint(info.si_pid, ==, *childpid);
 
+    // The child can't read anything else now.
+    *consumed = count_child_read(readerfd, written);
+
+    if (readerfd >= 0) {
+        g_close(readerfd, NULL);
+    }
+
+    g_debug("child %d consumed %lu bytes", *childpid, *consumed);
+
     // Terminate the watchdog thread, no longer necessary.
     if (kMaxProcessTime) {
         g_cond_signal(&timeout.condition);
@@ -19,7 +19,7 @@
 
 // This file is part of halfempty - a fast, parallel testcase minimization tool.
 
-gint submit_data_subprocess(gint inputfd, gsize inputlen, GPid *childpid);
+gint submit_data_subprocess(GArray *extents, GPid *childpid, gsize *consumed);
 
 #else
 # warning proc.h included twice
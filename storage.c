@@ -0,0 +1,275 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <sys/mman.h>
+# include <linux/fs.h>
+#endif
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "storage.h"
+#include "flags.h"
+#include "util.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// When we need a real file containing candidate data, we get an empty file from
+// one of these backends. Files are recycled rather than closed, so callers
+// should use storage_release() when they're finished.
+//
+// Candidates are normally delivered to children through a pipe without a file,
+// so in practice this is where the output is kept until it's saved. The heap
+// backend is just memfd, with small files written in one go.
+//
+
+typedef struct {
+    const gchar *name;
+    const gchar *description;
+    gint (*create)(void);
+    gboolean (*copy)(gint outfd, gint infd, goffset offset, gsize length);
+} backend_t;
+
+static gint create_tmp_file(void);
+static gint create_memfd_file(void);
+static gint create_dir_file(void);
+static gboolean copy_sendfile(gint outfd, gint infd, goffset offset, gsize length);
+static gboolean copy_reflink(gint outfd, gint infd, goffset offset, gsize length);
+
+static const backend_t kBackends[] = {
+    { "tmp", "Unlinked files in $TMPDIR", create_tmp_file, copy_sendfile },
+    { "memfd", "Anonymous memory files", create_memfd_file, copy_sendfile },
+    { "dir", "Unlinked files in a directory, e.g. dir:/dev/shm", create_dir_file, copy_sendfile },
+    { "reflink", "Share blocks with the input file if possible", create_dir_file, copy_reflink },
+    { "heap", "Like memfd, but small files are assembled in memory first", create_memfd_file, copy_sendfile },
+    { NULL },
+};
+
+// Candidates smaller than this are assembled in memory by the heap backend.
+static const gsize kMaxHeapSize = 1 << 20;
+
+// The maximum number of empty files we keep around for reuse.
+static const guint kMaxRecycledFiles = 16;
+
+static const backend_t *backend = &kBackends[0];
+static gchar *directory;
+static GQueue recycled = G_QUEUE_INIT;
+static GMutex recycledlock;
+
+gboolean decode_storage_backend(const gchar *option_name,
+                                const gchar *value,
+                                gpointer data,
+                                GError **error)
+{
+    gchar **param = g_strsplit(value, ":", 2);
+    const backend_t *found;
+
+    for (found = kBackends; found->name; found++) {
+        if (g_strcmp0(found->name, param[0]) == 0)
+            break;
+    }
+
+    if (found->name == NULL) {
+        g_warning("You passed the string %s to %s, but that is not a storage backend",
+                  value,
+                  option_name);
+
+        for (const backend_t *list = kBackends; list->name; list++) {
+            g_warning("    %-8s %s", list->name, list->description);
+        }
+
+        g_strfreev(param);
+        return false;
+    }
+
+    if (g_strcmp0(found->name, "dir") == 0 && param[1] == NULL) {
+        g_warning("The dir backend requires a directory, for example, %s dir:/dev/shm",
+                  option_name);
+        g_strfreev(param);
+        return false;
+    }
+
+    if (g_strcmp0(found->name, "dir") != 0 && param[1] != NULL) {
+        g_warning("The %s backend doesn't take a directory, only dir does",
+                  found->name);
+        g_strfreev(param);
+        return false;
+    }
+
+    g_free(directory);
+
+    directory = g_strdup(param[1]);
+    backend   = found;
+
+    g_strfreev(param);
+    return true;
+}
+
+// Unlinked files in the system temporary directory.
+static gint create_tmp_file(void)
+{
+    return g_unlinked_tmp(NULL);
+}
+
+// Anonymous memory, this never touches a disk.
+static gint create_memfd_file(void)
+{
+    gint fd = -1;
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    fd = memfd_create("halfempty", MFD_CLOEXEC);
+#endif
+
+    if (fd == -1) {
+        return create_tmp_file();
+    }
+
+    return fd;
+}
+
+// Unlinked files in the specified directory. If no directory was specified,
+// use the same directory as the input, reflinks need the same filesystem.
+static gint create_dir_file(void)
+{
+    gint fd = -1;
+    gchar *filename;
+
+    if (directory == NULL) {
+        directory = g_path_get_dirname(kInputFile);
+    }
+
+#ifdef O_TMPFILE
+    fd = open(directory, O_TMPFILE | O_RDWR, 0600);
+#endif
+
+    if (fd == -1) {
+        filename = g_build_filename(directory, "halfempty.XXXXXX", NULL);
+
+        if ((fd = g_mkstemp(filename)) != -1) {
+            g_unlink(filename);
+        }
+
+        g_free(filename);
+    }
+
+    if (fd == -1) {
+        g_warning("failed to create file in %s, %s", directory, strerror(errno));
+        return create_tmp_file();
+    }
+
+    return fd;
+}
+
+static gboolean copy_sendfile(gint outfd, gint infd, goffset offset, gsize length)
+{
+    return g_sendfile_all(outfd, infd, offset, length);
+}
+
+// Try to share blocks with the source file, this only works on some
+// filesystems and only for block aligned ranges, so fallback to copying.
+static gboolean copy_reflink(gint outfd, gint infd, goffset offset, gsize length)
+{
+#ifdef __linux__
+    goffset destination = lseek(outfd, 0, SEEK_CUR);
+    gssize  result;
+
+# ifdef FICLONERANGE
+    struct file_clone_range range = {
+        .src_fd         = infd,
+        .src_offset     = offset,
+        .src_length     = length,
+        .dest_offset    = destination,
+    };
+
+    if (ioctl(outfd, FICLONERANGE, &range) == 0) {
+        return lseek(outfd, destination + length, SEEK_SET) != -1;
+    }
+# endif
+
+    // The kernel may still be able to avoid copying the data.
+    while (length > 0) {
+        if ((result = copy_file_range(infd, &offset, outfd, NULL, length, 0)) <= 0)
+            break;
+
+        length -= result;
+    }
+
+    if (length == 0)
+        return true;
+#endif
+
+    return g_sendfile_all(outfd, infd, offset, length);
+}
+
+// Get an empty file to write data into.
+gint storage_acquire(void)
+{
+    gint fd;
+
+    g_mutex_lock(&recycledlock);
+
+    fd = GPOINTER_TO_INT(g_queue_pop_head(&recycled)) - 1;
+
+    g_mutex_unlock(&recycledlock);
+
+    if (fd == -1) {
+        fd = backend->create();
+    }
+
+    return fd;
+}
+
+// Finished with this file, keep it for reuse if we can.
+void storage_release(gint fd)
+{
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        g_close(fd, NULL);
+        return;
+    }
+
+    g_mutex_lock(&recycledlock);
+
+    if (g_queue_get_length(&recycled) < kMaxRecycledFiles) {
+        g_queue_push_tail(&recycled, GINT_TO_POINTER(fd + 1));
+        fd = -1;
+    }
+
+    g_mutex_unlock(&recycledlock);
+
+    if (fd != -1) {
+        g_close(fd, NULL);
+    }
+}
+
+// Copy a range of infd to the current position in outfd.
+gboolean storage_copy(gint outfd, gint infd, goffset offset, gsize length)
+{
+    return backend->copy(outfd, infd, offset, length);
+}
+
+// Should a file of this size be assembled in memory before it's written?
+gboolean storage_buffered(gsize size)
+{
+    return g_strcmp0(backend->name, "heap") == 0 && size <= kMaxHeapSize;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __STORAGE_H
+#define __STORAGE_H
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+
+gboolean decode_storage_backend(const gchar *option_name,
+                                const gchar *value,
+                                gpointer data,
+                                GError **error);
+gint storage_acquire(void);
+void storage_release(gint fd);
+gboolean storage_copy(gint outfd, gint infd, goffset offset, gsize length);
+gboolean storage_buffered(gsize size);
+
+#else
+# warning storage.h included twice
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "task.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// We create and destroy a task for every test we run, so they're allocated in
+// blocks and recycled rather than returned to the system.
+//
+
+// Number of tasks we allocate at a time.
+static const guint kTasksPerBlock = 256;
+
+// Free tasks, linked together through their user pointer.
+static task_t *freetasks;
+static GMutex freetaskslock;
+
+// Returns a zeroed task.
+task_t * task_new(void)
+{
+    task_t *task;
+
+    g_mutex_lock(&freetaskslock);
+
+    if (freetasks == NULL) {
+        task_t *block = g_new(task_t, kTasksPerBlock);
+
+        for (guint i = 0; i < kTasksPerBlock; i++) {
+            block[i].user = freetasks;
+            freetasks     = &block[i];
+        }
+    }
+
+    task      = freetasks;
+    freetasks = task->user;
+
+    g_mutex_unlock(&freetaskslock);
+
+    return memset(task, 0, sizeof *task);
+}
+
+// Return a task to the pool, the data must already have been released.
+void task_free(task_t *task)
+{
+    task_user_free(task);
+
+    g_mutex_lock(&freetaskslock);
+
+    task->user = freetasks;
+    freetasks  = task;
+
+    g_mutex_unlock(&freetaskslock);
+}
@@ -24,16 +24,86 @@ typedef enum {
     TASK_STATUS_DISCARDED,      // The task was pending, but got cancelled.
 } status_t;
 
-typedef struct {
-    gint        fd;         // Data for this node, or -1 if none. rw lock required.
+// Note that the mutex is only held for short periods, it is never held while
+// a child process is running. A worker marks the task running while it uses
+// the extents and childpid, and if the task is discarded in the meantime it's
+// the workers responsibility to release them.
+// Small strategy state is stored inside the task, see task_user_new().
+#define TASK_USER_SIZE 64
+
+typedef struct task {
+    GArray     *extents;    // Data for this node, or NULL if none. rw lock required.
     gsize       size;       // Size of this data. rw lock required.
     gpointer    user;       // Strategy-specific context. rw lock required.
     status_t    status;     // Task status (completed, pending, etc). atomic rw required.
     GMutex      mutex;      // Mutex.
-    GTimer     *timer;      // Used to calculate total compute time.
-    GPid        childpid;   // pid of active task, if applicable.
+    gint64      started;    // Monotonic time the task started, or zero.
+    gint64      elapsed;    // Microseconds spent executing the task.
+    GPid        childpid;   // pid of active task, if applicable. atomic.
+    guint       depth;      // Distance from the root, nearer runs first.
+    gint        preempted;  // Killed to make room for critical work. atomic.
+    gboolean    running;    // A worker is using extents and childpid. lock required.
+    gboolean    orphaned;   // Discarded while running. lock required.
+    guint       generation; // Number of strategies run before this one.
+    gsize       roundsize;  // Size when the current --stable round started.
+    gint        refcount;   // Queued or running pool jobs using this task. atomic.
+    gsize       reserved;   // Bytes counted against the speculation budget.
+    struct task *source;    // Nearest successful ancestor when created.
+    gboolean    first;      // The first task of its strategy.
+    gsize       consumed;   // Bytes the child read, valid once executed.
+    gboolean    truncated;  // Created by truncation, not by the strategy.
+    gsize       usersize;   // Size of the strategy state.
+    guint64     userdata[TASK_USER_SIZE / sizeof(guint64)];
 } task_t;
 
+task_t * task_new(void);
+void task_free(task_t *task);
+
+// Allocate zeroed strategy state for task, this is stored in the task itself
+// if it fits.
+static inline gpointer task_user_new(task_t *task, gsize size)
+{
+    if (size <= sizeof task->userdata) {
+        task->user = task->userdata;
+    } else {
+        task->user = g_malloc(size);
+    }
+
+    task->usersize = size;
+
+    return memset(task->user, 0, size);
+}
+
+static inline void task_user_free(task_t *task)
+{
+    if (task->user != task->userdata) {
+        g_free(task->user);
+    }
+
+    task->user     = NULL;
+    task->usersize = 0;
+}
+
+// Seconds spent executing this task.
+static inline gdouble task_elapsed(task_t *task)
+{
+    return task->elapsed / (gdouble) G_TIME_SPAN_SECOND;
+}
+
+// Task status can change at any time, unless you know the task is finalized
+// use these to examine or modify it.
+static inline status_t task_status(task_t *task)
+{
+    return g_atomic_int_get((gint *) &task->status);
+}
+
+// Move a task from one status to another, returns false if another thread
+// changed it first.
+static inline gboolean task_transition(task_t *task, status_t from, status_t to)
+{
+    return g_atomic_int_compare_and_exchange((gint *) &task->status, from, to);
+}
+
 static inline const gchar * string_from_status(status_t status)
 {
     const gchar * names[] = {
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Copyright 2018 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# flag: --ddmin
+
+# Two lines far apart in the input, ddmin has to find both.
+# Every line is the same width, so a shortened line can't pass for one of them.
+awk '/^0000017$/ { a = 1 } /^0000923$/ { b = 1 } END { exit !(a && b) }'
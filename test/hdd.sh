@@ -0,0 +1,34 @@
+#!/bin/sh
+# Copyright 2018 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# flag: --hdd
+
+# The brackets have to balance, and bisect has to be inside some of them. The
+# input has a stray [ that hdd has to skip over.
+awk '
+    { data = data $0 "\n" }
+    END {
+        depth = 0
+        for (i = 1; i <= length(data); i++) {
+            c = substr(data, i, 1)
+            if (c == "{") stack[++depth] = "}"
+            else if (c == "(") stack[++depth] = ")"
+            else if (c == "}" || c == ")") {
+                if (depth == 0 || stack[depth] != c) exit 1
+                depth--
+            } else if (substr(data, i, 6) == "bisect" && depth > 0) found = 1
+        }
+        exit !(found && depth == 0)
+    }'
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "replace"
+#define HALFEMPTY_PLUGIN
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../task.h"
+#include "../tree.h"
+#include "../extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// An example strategy plugin, used by plugin.sh. It tries replacing the whole
+// input with --replace-text in a single candidate.
+//
+
+STRATEGY_PLUGIN();
+
+static gchar *kReplaceText = "";
+
+static const GOptionEntry kReplaceOptions[] = {
+    { "replace-text", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &kReplaceText,
+        "Try replacing the input with this text.",
+        "text" },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Replace the whole input with a fixed string";
+
+static task_t * strategy_replace_data(GNode *node)
+{
+    task_t *parent = node->data;
+    task_t *child;
+    gsize   length = strlen(kReplaceText);
+
+    // We don't need any state, we only produce one candidate.
+    if (parent->user == NULL) {
+        if (length == 0 || length > parent->size)
+            return NULL;
+
+        task_user_new(parent, 1);
+        return parent;
+    }
+
+    if (g_node_strategy_root(node) == false)
+        return NULL;
+
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+
+    task_user_new(child, 1);
+
+    g_mutex_lock(&parent->mutex);
+
+    // Keep the first length bytes, and then overwrite them.
+    child->extents = extent_delete(parent->extents, length, parent->size - length);
+
+    g_mutex_unlock(&parent->mutex);
+
+    for (gsize i = 0; i < length; i++) {
+        GArray *result = extent_fill(child->extents, i, 1, kReplaceText[i]);
+
+        g_array_unref(child->extents);
+        child->extents = result;
+    }
+
+    child->size = extent_size(child->extents);
+
+    return child;
+}
+
+REGISTER_STRATEGY(replace, kDescription, kReplaceOptions, strategy_replace_data);
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Copyright 2018 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# flag: --strategy-plugin=./plugin.so
+# flag: --replace-text=plugin
+
+# Same as grep.sh, but the plugin can also replace everything with a string
+# bisect could never find.
+data=$(cat)
+
+test "$data" = "plugin" || printf '%s\n' "$data" | grep -q ^bisect$
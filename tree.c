@@ -33,6 +33,7 @@
 #include "util.h"
 #include "tree.h"
 #include "flags.h"
+#include "extent.h"
 
 // This file is part of halfempty - a fast, parallel testcase minimization tool.
 //
@@ -47,11 +48,36 @@ static GNode * find_finalized_node(GNode *root, gboolean success);
 static gdouble path_total_elapsed(GNode *node);
 static gint print_status_message(GTimer *elapsed, gint finaldepth);
 static void generate_itermediate_file(gint finaldepth);
-static gint collapse_finalized_failure_paths(void);
+static void collapse_finalized_failure_paths(void);
+static void prune_finalized_prefix(void);
+static void retire_subtree(GNode *head);
+static void reap_pruned_nodes(void);
+static guint absolute_depth(GNode *node);
+static guint adjust_queue_depth(void);
+static void release_task_resources(task_t *task);
+static void submit_task(GNode *node);
+static gint compare_task_priority(gconstpointer a,
+                                  gconstpointer b,
+                                  gpointer user);
+static void preempt_speculative_tasks(void);
+static task_t * generate_task(GNode *node);
+static task_t * handover_task(GNode *node);
+static task_t * truncate_task(GNode *node);
+static gboolean advance_strategy(task_t *task);
+static void print_strategy_progress(void);
+static void initialize_thread_pools(void);
+static void drain_thread_pools(void);
+static void push_pool_job(GThreadPool *pool, gpointer data);
+static void release_speculative_bytes(task_t *task);
+static void unregister_pending_task(task_t *task);
+static GHashTable * pending_branch(task_t *task, gboolean success);
+static void free_pending_branches(gpointer data);
+static void move_pending_tasks(GNode *node, GNode *head);
+static gboolean speculative_budget_exhausted(void);
 
 // This binary tree represents our path through the testcases we've generated
-// so far. The root node contains the original input (although we may have
-// thrown away the data as we no longer need it, but the task will remain).
+// so far. The root node initially contains the original input, and later the
+// most recent finalized success.
 //
 // To iterate through the tree, you choose whether you want the success branch
 //
@@ -59,18 +85,60 @@ static gint collapse_finalized_failure_paths(void);
 //   or
 // curr = g_node_failure(tree);
 //
-// Nodes are never removed from the tree, but new ones may be added, and
-// existing nodes may change (but they will be locked).
+// Once the path to a success node is finalized, everything above it can never
+// change. That node becomes the new root, and the nodes above it are freed as
+// soon as no pool jobs refer to them, we only keep a summary.
 //
 
+struct tree_stats {
+    gint failure;
+    gint success;
+    gint discarded;
+    gdouble elapsed;
+};
+
 static GNode *tree;
-static GNode *retired;
+static GQueue graveyard = G_QUEUE_INIT;     // Detached subtrees waiting to be freed.
+static struct tree_stats prunedstats;       // Summary of freed nodes.
+static guint prunednodes;                   // Number of freed nodes.
+static guint pruneddepth;                   // Depth of the current root.
 static GMutex treelock;
 static GCond treecond;
 static GThreadPool *threadpool;
 static GThreadPool *cleanup;
+static gint outstanding;        // Jobs pushed but not yet completed. atomic.
+static GMutex pendinglock;      // Protects the pending maps, nests inside treelock.
 static gdouble collapsedtime;
 
+// Every pending task is listed in a set on each branch above it, so we can find
+// the pending tasks under a node without walking the tree. pendingbranches
+// maps a task to the sets for its failure and success branches, pendingtasks
+// maps a pending task to the sets it's listed in.
+static GHashTable *pendingbranches;
+static GHashTable *pendingtasks;
+
+// The generator stops producing work when there are more than queuedepth
+// unprocessed workunits, see adjust_queue_depth(). The counters are updated by
+// workers as results arrive, and consumed by the generator.
+static guint queuedepth;
+static const gchar *queuereason;
+static gint recentfailures;     // Tests that failed as predicted. atomic.
+static gint recentdiscards;     // Pending tasks on mispredicted paths. atomic.
+static gint recentidle;         // Workers that found the queue empty. atomic.
+
+// Bytes of candidate data held by pending tasks, the generator won't create
+// more work while this exceeds kMaxSpeculativeBytes.
+static gssize speculativebytes; // atomic.
+
+// Nodes currently being executed by a worker, so that we can find something to
+// preempt if a more important task is waiting.
+static GQueue running = G_QUEUE_INIT;
+static GMutex runninglock;
+static gint preemptions;
+
+// The generation of the deepest finalized success node we've reported.
+static guint finalgeneration;
+
 gint kNumStrategies;
 strategy_t kStrategyList[MAX_STRATEGIES];
 
@@ -78,45 +146,45 @@ strategy_t kStrategyList[MAX_STRATEGIES];
 // strategy callbacks. It waits for workunits to complete, and then fills up
 // the queue again.
 gboolean build_bisection_tree(gint fd,
-                              strategy_cb_t callback,
                               gint *outfd,
                               gulong flags)
 {
     gint finaldepth;
     gint backoff;
+    gsize size;
     task_t *root;
     GTimer *elapsed;
 
-    // Initialize threadpool workers, each one simply executes a testcase and
-    // updates the tree with the result.
-    threadpool = g_thread_pool_new((GFunc) process_execute_jobs,
-                                   NULL,
-                                   kProcessThreads,
-                                   TRUE,
-                                   NULL);
+    // The pools are only created once and reused for every tree.
+    initialize_thread_pools();
 
-    // This threadpool just cleans up tasks and mostly just waits on locks.
-    cleanup = g_thread_pool_new((GFunc) cleanup_orphaned_tasks,
-                                NULL,
-                                kCleanupThreads,
-                                FALSE,
-                                NULL);
+    // All candidates are described in terms of the original input.
+    size = extent_set_input(fd);
 
     backoff         = 0;
     finaldepth      = 0;
-    root            = g_new0(task_t, 1);
+    preemptions     = 0;
+    finalgeneration = 0;
+    root            = task_new();
     tree            = g_node_new(root);
-    retired         = g_node_new(NULL);
-    root->fd        = fd;
-    root->size      = g_file_size(fd);
+    pruneddepth     = 0;
+    prunednodes     = 0;
+    prunedstats     = (struct tree_stats) { 0 };
+    collapsedtime   = 0;
+    root->size      = size;
+    root->extents   = extent_new_input(root->size);
     root->status    = TASK_STATUS_PENDING;
+    root->roundsize = root->size;
+    root->first     = true;
     elapsed         = g_timer_new();
+    queuedepth      = MAX(kMaxUnprocessed, 1);
+    queuereason     = "initial";
 
     // Verify the input task is sane.
     if (kVerifyInput) {
         g_print("Verifying the original input executes successfully... (skip with --noverify)");
         process_execute_jobs(tree);
-        if (root->status != TASK_STATUS_SUCCESS) {
+        if (task_status(root) != TASK_STATUS_SUCCESS) {
             g_message("This program expected `%s` to return successfully",
                       kCommandPath);
             g_message("for the original input (i.e. exitcode zero).");
@@ -129,31 +197,32 @@ gboolean build_bisection_tree(gint fd,
             return false;
         } else {
             g_print("The original input file succeeded after %.1f seconds.",
-                    g_timer_elapsed(root->timer, NULL));
+                    task_elapsed(root));
         }
     } else {
         // Just fake it.
         root->status = TASK_STATUS_SUCCESS;
-        root->timer  = g_timer_new();
-        g_timer_stop(root->timer);
     }
 
-    // Initialize the root node
-    callback(tree);
-
     // Keep track of time taken.
     g_timer_reset(elapsed);
 
     while (true) {
-        GNode *current = tree;
+        GNode *current;
+        guint  depth;
 
         // Take the treelock so we can modify the tree.
         g_mutex_lock(&treelock);
 
+        // Only tune the depth once per pass, the condition below is evaluated
+        // on every wakeup, including timeouts.
+        depth = adjust_queue_depth();
+
         // Don't generate too much work or we'll explore too far down a wrong
         // path.
         // This condition is always signaled when a workunit completes.
-        while (g_thread_pool_unprocessed(threadpool) > kMaxUnprocessed)
+        while (g_thread_pool_unprocessed(threadpool) > depth
+            || speculative_budget_exhausted())
             g_cond_wait_until(&treecond,
                               &treelock,
                               g_get_monotonic_time() + kMaxWaitTime);
@@ -161,6 +230,9 @@ gboolean build_bisection_tree(gint fd,
         // Now that we have the lock, the tree is stable until we release it.
         g_debug("generator thread obtained treelock, finding next leaf");
 
+        // Make sure we're not waiting on speculative work.
+        preempt_speculative_tasks();
+
         // Generate intermediate file (do this _before_ updating the final depth!)
         generate_itermediate_file(finaldepth);
 
@@ -169,11 +241,24 @@ gboolean build_bisection_tree(gint fd,
         // along it's path to the root is complete (i.e. not pending).
         finaldepth = print_status_message(elapsed, finaldepth);
 
+        // Let the user know when a strategy has finished.
+        print_strategy_progress();
+
+        // Nothing above the last finalized success can change, so we don't
+        // need to keep it.
+        prune_finalized_prefix();
+
         // We can collapse exceptionally long trees so that we're not wasting
         // valuable cycles traversing linked lists. Note that we never delete a
         // success node, but dont care about failure nodes.
         if (g_node_max_height(tree) > kMaxTreeDepth)
-            finaldepth = collapse_finalized_failure_paths();
+            collapse_finalized_failure_paths();
+
+        // Free anything that workers have finished with.
+        reap_pruned_nodes();
+
+        // The root might have changed.
+        current = tree;
 
         // Scan for the next location to insert work.
         // The idea is this, from the root:
@@ -191,7 +276,7 @@ gboolean build_bisection_tree(gint fd,
             // g_node_new(NULL) below. It turns out we do need this, so just
             // replace it with a real workunit.
             if (currtask == NULL) {
-                current->data = callback(current->parent);
+                current->data = generate_task(current->parent);
 
                 // I use depth to indent the messages so you can see the
                 // progress.
@@ -221,22 +306,25 @@ gboolean build_bisection_tree(gint fd,
                 }
 
                 // That worked, submit the task.
-                g_thread_pool_push(threadpool, current, NULL);
+                submit_task(current);
                 break;
             }
 
             // We should never traverse into a discarded branch.
-            g_assert_cmpint(currtask->status, !=, TASK_STATUS_DISCARDED);
+            g_assert_cmpint(task_status(currtask), !=, TASK_STATUS_DISCARDED);
 
             g_debug("%*sfound a %s task, size %lu ",
                     depth,
                     "",
-                    string_from_status(currtask->status),
+                    string_from_status(task_status(currtask)),
                     currtask->size);
 
             // If this is a leaf node, then we need to append a new task here.
             if (G_NODE_IS_LEAF(current)) {
-                task_t *child = callback(current);
+                // Decide which branch the child belongs on before we create
+                // it, the child must be based on the same view of its parent.
+                gboolean succeeded = task_status(currtask) == TASK_STATUS_SUCCESS;
+                task_t  *child     = generate_task(current);
 
                 g_debug("%*snode is a leaf node, generating children",
                         depth,
@@ -247,12 +335,9 @@ gboolean build_bisection_tree(gint fd,
                     // We can't generate any more work, but that doesn't mean
                     // we're finished - there might be unprocessed work in the
                     // queue that changes our path through the tree.
+                    // Anything left in the threadpool must be on a discarded
+                    // branch, the workers will skip it.
                     if (root_path_finalized(current) == true) {
-                        // The threadpool must be empty, because we've
-                        // discarded everything else?
-                        g_assert_cmpint(g_thread_pool_unprocessed(threadpool),
-                                        ==,
-                                        0);
                         goto finalized;
                     }
                     goto delay;
@@ -261,22 +346,18 @@ gboolean build_bisection_tree(gint fd,
                 // Is the node above us already finalized and is successful? If
                 // so, we know which route to take. otherwise, we just guess
                 // it's going to fail.
-                if (currtask->status == TASK_STATUS_SUCCESS) {
+                if (succeeded) {
                     // Placeholder Failure node
                     g_node_insert(current, false, g_node_new(NULL));
                     // Success node
-                    g_thread_pool_push(threadpool,
-                                       g_node_insert(current,
-                                                     true,
-                                                     g_node_new(child)),
-                                                     NULL);
+                    submit_task(g_node_insert(current,
+                                              true,
+                                              g_node_new(child)));
                 } else {
                     // Failure node
-                    g_thread_pool_push(threadpool,
-                                       g_node_insert(current,
-                                                     false,
-                                                     g_node_new(child)),
-                                                     NULL);
+                    submit_task(g_node_insert(current,
+                                              false,
+                                              g_node_new(child)));
                     // Placeholder Success node
                     g_node_insert(current, true, g_node_new(NULL));
                 }
@@ -290,7 +371,7 @@ gboolean build_bisection_tree(gint fd,
             g_debug("%*snode is not a leaf, traversing", depth, "");
 
             // This is not a leaf, so traverse
-            if (currtask->status == TASK_STATUS_SUCCESS) {
+            if (task_status(currtask) == TASK_STATUS_SUCCESS) {
                 current = g_node_success(current);
             } else {
                 current = g_node_failure(current);
@@ -313,16 +394,32 @@ gboolean build_bisection_tree(gint fd,
         g_print("Reached the end of our path through tree, "
                 "all nodes were finalized");
 
+        // Report the final strategy.
+        print_strategy_progress();
+
+        g_print("Strategy \"%s\" complete, output %lu bytes",
+                kStrategyList[finalgeneration % kNumStrategies].name,
+                ((task_t *)(find_finalized_node(tree, true)->data))->size);
+
+        if (kIterateUntilStable) {
+            g_print("Minimization stable, all work done.");
+        }
+
         // Unlock the tree and let threadpool workers finish.
         g_mutex_unlock(&treelock);
-        g_thread_pool_free(threadpool, FALSE, TRUE);
-        g_thread_pool_free(cleanup, FALSE, TRUE);
+        drain_thread_pools();
 
         // Cleanup and produce output.
         show_tree_statistics();
         duplicate_final_node(outfd);
         cleanup_tree();
         g_timer_destroy(elapsed);
+
+        // Nothing refers to the original input now.
+        if (flags & BISECT_FLAG_CLOSEINPUT) {
+            g_close(fd, NULL);
+        }
+
         return true;
 
     delay:
@@ -339,13 +436,22 @@ gboolean build_bisection_tree(gint fd,
 
 // This routine cleans up tasks that are on discarded branches.
 // This is the only location that tasks are destroyed and should only be called
-// from the gc thread.
+// from the gc thread. It never waits for a child to exit, if the task is still
+// running the worker will release the resources when it's finished.
 void cleanup_orphaned_tasks(task_t *task)
 {
-    GPid childpid = task->childpid;
+    GPid childpid;
 
     g_assert(task);
 
+    // Ensure pending tasks dont get executed.
+    if (task_transition(task, TASK_STATUS_PENDING, TASK_STATUS_DISCARDED)) {
+        release_speculative_bytes(task);
+        unregister_pending_task(task);
+    }
+
+    childpid = g_atomic_int_get(&task->childpid);
+
     // If requested, aggressively try to cleanup discarded tasks.
     if (kKillFailedWorkers && childpid > 0) {
         kill(-childpid, kKillFailedWorkersSignal);
@@ -354,31 +460,27 @@ void cleanup_orphaned_tasks(task_t *task)
     g_debug("thread %p cleaning up task %p (pid=%d), now attempting to lock",
             g_thread_self(),
             task,
-            task->childpid);
+            childpid);
 
     g_mutex_lock(&task->mutex);
 
     g_debug("thread %p acquired lock on task %p, state %s",
             g_thread_self(),
             task,
-            string_from_status(task->status));
+            string_from_status(task_status(task)));
 
-    // Ensure pending tasks dont get executed. 
-    if (task->status == TASK_STATUS_PENDING)
-        task->status = TASK_STATUS_DISCARDED;
+    // If a worker is still using the resources, let it clean up when it's
+    // finished.
+    if (task->running) {
+        g_debug("task %p is still running, worker will cleanup", task);
+        task->orphaned = true;
+        g_mutex_unlock(&task->mutex);
+        return;
+    }
 
     // We hold the lock on this task now, so can clean up the file descriptor
     // and zombie.
-    g_close(task->fd, NULL);
-
-    if (task->childpid > 0) {
-        if (waitpid(task->childpid, NULL, WNOHANG) != task->childpid) {
-            g_critical("waitpid() didn't return immediately with zombie, this shouldn't happen");
-        }
-    }
-
-    task->fd       = -1;
-    task->childpid = 0;
+    release_task_resources(task);
 
     // Nothing else we need to do, unlock.
     g_mutex_unlock(&task->mutex);
@@ -386,35 +488,76 @@ void cleanup_orphaned_tasks(task_t *task)
     g_debug("task %p unlocked by %p, now discarded", task, g_thread_self());
 }
 
-static gboolean abort_task_helper(GNode *node, gpointer data)
+// Release the data and reap the zombie, if any.
+// XXX: must hold task lock, and task must not be running.
+static void release_task_resources(task_t *task)
 {
-    // We can't lock tasks here or we would deadlock, so push them on a
-    // queue to cleanup later.
-    if (node->data) {
-        g_thread_pool_push(cleanup, node->data, NULL);
+    GPid childpid = g_atomic_int_get(&task->childpid);
+
+    g_assert_false(task->running);
+
+    if (task->extents) {
+        g_array_unref(task->extents);
     }
-    return false;
+
+    if (childpid > 0) {
+        if (waitpid(childpid, NULL, WNOHANG) != childpid) {
+            g_critical("waitpid() didn't return immediately with zombie, this shouldn't happen");
+        }
+    }
+
+    task->extents = NULL;
+
+    g_atomic_int_set(&task->childpid, 0);
 }
 
-void abort_pending_tasks(GNode *root)
+// Returns the set of pending tasks on one branch below task, or NULL if there
+// has never been one.
+// XXX: must hold pendinglock.
+static GHashTable * lookup_pending_branch(task_t *task, gboolean success)
 {
-    if (root == NULL) {
-        g_debug("abort_pending_tasks() called, but no child nodes to traverse");
-        return;
+    GHashTable **branches = g_hash_table_lookup(pendingbranches, task);
+
+    return branches ? branches[success] : NULL;
+}
+
+// Discard every pending task on one branch below task, and return how many
+// there were. Anything already completed is released when it's pruned.
+// XXX: must hold pendinglock.
+static gint discard_pending_branch(task_t *task, gboolean success)
+{
+    GHashTable *branch = lookup_pending_branch(task, success);
+    GHashTableIter iter;
+    gpointer pending;
+    gint discarded = 0;
+
+    if (branch == NULL)
+        return 0;
+
+    g_hash_table_iter_init(&iter, branch);
+
+    while (g_hash_table_iter_next(&iter, &pending, NULL)) {
+        // We can't lock tasks here or we would deadlock, so push them on a
+        // queue to cleanup later.
+        push_pool_job(cleanup, pending);
+        discarded++;
     }
 
-    // Prevent any new jobs from being inserted.
-    g_mutex_lock(&treelock);
+    return discarded;
+}
 
-    g_node_traverse(root,
-                    G_PRE_ORDER,
-                    G_TRAVERSE_ALL,
-                    -1,
-                    abort_task_helper,
-                    NULL);
+// Discard every task on the failure branch of task that hasn't completed yet.
+// This only needs the pending lock, the tree can keep growing meanwhile.
+void abort_pending_tasks(task_t *task)
+{
+    gint discarded;
 
-    // Let work continue.
-    g_mutex_unlock(&treelock);
+    g_mutex_lock(&pendinglock);
+    discarded = discard_pending_branch(task, false);
+    g_mutex_unlock(&pendinglock);
+
+    // Tell the generator we speculated too far.
+    g_atomic_int_add(&recentdiscards, discarded);
 }
 
 // Is the path from this node to the root node finalized or pending?
@@ -426,8 +569,8 @@ static gboolean root_path_finalized(GNode *node)
 
         g_assert_nonnull(task);
 
-        if (task->status != TASK_STATUS_SUCCESS
-         && task->status != TASK_STATUS_FAILURE)
+        if (task_status(task) != TASK_STATUS_SUCCESS
+         && task_status(task) != TASK_STATUS_FAILURE)
             return false;
     }
 
@@ -438,45 +581,104 @@ static gboolean root_path_finalized(GNode *node)
 void process_execute_jobs(GNode *node)
 {
     task_t *task = node->data;
-    gint result;
+    gint result = -1;
+    GArray *extents;
 
     g_assert(task);
+
+    // If nothing else is queued behind us, the generator isn't keeping up.
+    if (threadpool && g_thread_pool_unprocessed(threadpool) == 0)
+        g_atomic_int_inc(&recentidle);
+
+    // We only need the lock long enough to claim the task, other threads can
+    // examine and even discard it while the child is running.
     g_mutex_lock(&task->mutex);
 
-    // Note that other threads can examine this task, but cannot modify it
-    // while locked. It is not permitted to use the file descriptor without
-    // holding the lock.
-    g_debug("thread %p processing task %p, size %lu, fd %d, status %s",
+    g_debug("thread %p processing task %p, size %lu, extents %p, status %s",
             g_thread_self(),
             task,
             task->size,
-            task->fd,
-            string_from_status(task->status));
+            task->extents,
+            string_from_status(task_status(task)));
 
     // Check before we start the task.
-    if (task->status == TASK_STATUS_DISCARDED) {
+    if (task_status(task) == TASK_STATUS_DISCARDED) {
         g_debug("task %p was discarded, nothing left to do", task);
         g_mutex_unlock(&task->mutex);
         return;
     }
 
     // The only two possibilities are discarded and pending.
-    g_assert_cmpint(task->status, ==, TASK_STATUS_PENDING);
-    g_assert(task->timer == NULL);
+    g_assert_cmpint(task_status(task), ==, TASK_STATUS_PENDING);
+    g_assert_cmpint(task->started, ==, 0);
+    g_assert_false(task->running);
 
-    // Keep track of time elapsed;
-    task->timer = g_timer_new();
+    // The data now belongs to us until we clear running.
+    task->running = true;
+    extents       = task->extents;
 
-    // Spawn a process to find result.
-    result = submit_data_subprocess(task->fd, task->size, &task->childpid);
+    g_mutex_unlock(&task->mutex);
+
+    // Let the generator know we're working on this.
+    g_mutex_lock(&runninglock);
+    g_queue_push_tail(&running, node);
+    g_mutex_unlock(&runninglock);
+
+    // Keep track of time elapsed;
+    task->started = g_get_monotonic_time();
+
+    // Spawn a process to find result, unless something more important came
+    // along while we were waiting for the lock.
+    if (g_atomic_int_get(&task->preempted) == false) {
+        result = submit_data_subprocess(extents,
+                                        &task->childpid,
+                                        &task->consumed);
+    }
 
     // Count elapsed time.
-    g_timer_stop(task->timer);
+    task->elapsed = g_get_monotonic_time() - task->started;
+
+    g_mutex_lock(&runninglock);
+    g_queue_remove(&running, node);
+    g_mutex_unlock(&runninglock);
+
+    g_mutex_lock(&task->mutex);
+
+    task->running = false;
+
+    // If we were discarded while the child was running, nobody else can
+    // release the resources.
+    if (task->orphaned) {
+        g_debug("task %p was discarded while running, cleaning up", task);
+        release_task_resources(task);
+        g_mutex_unlock(&task->mutex);
+        g_cond_signal(&treecond);
+        return;
+    }
+
+    // If we were preempted, the result is meaningless. Forget we ever started
+    // and go back in the queue behind the critical task.
+    if (g_atomic_int_get(&task->preempted)) {
+        g_debug("task %p was preempted, pid %d, requeuing", task, task->childpid);
+
+        if (task->childpid > 0) {
+            waitpid(task->childpid, NULL, 0);
+        }
+
+        task->started = 0;
+        task->elapsed = 0;
+
+        g_atomic_int_set(&task->childpid, 0);
+        g_atomic_int_set(&task->preempted, false);
+        g_mutex_unlock(&task->mutex);
+        push_pool_job(threadpool, node);
+        return;
+    }
 
     g_debug("thread %p, child returned %d after %.3f seconds, size %lu",
             g_thread_self(),
             result,
-            g_timer_elapsed(task->timer, NULL),
+            task_elapsed(task),
             task->size);
 
     g_assert_cmpint(task->childpid, !=, 0);
@@ -484,20 +686,28 @@ void process_execute_jobs(GNode *node)
     switch (result) {
         case  0: g_debug("task %p success, aborting mispredicted jobs", task);
 
-                 // Update status.
-                 task->status = TASK_STATUS_SUCCESS;
+                 // Update status, unless we were discarded in the meantime.
+                 if (task_transition(task,
+                                     TASK_STATUS_PENDING,
+                                     TASK_STATUS_SUCCESS) == false) {
+                     g_mutex_unlock(&task->mutex);
+                     break;
+                 }
+
+                 release_speculative_bytes(task);
+                 unregister_pending_task(task);
 
                  // We don't need to hold the lock anymore.
                  g_mutex_unlock(&task->mutex);
 
                  // Any tasks on the failure branch were mispredicted.
-                 abort_pending_tasks(g_node_failure(node));
+                 abort_pending_tasks(task);
 
                  // Print status message
                  g_info("thread %p found task %p succeeded after %.3f seconds, size %lu, depth %d",
                         g_thread_self(),
                         task,
-                        g_timer_elapsed(task->timer, NULL),
+                        task_elapsed(task),
                         task->size,
                         g_node_depth(node));
 
@@ -505,19 +715,25 @@ void process_execute_jobs(GNode *node)
                  // All non-zero exit codes and failures are discarded.
         default: g_debug("unexpected result %d from task %p", result, task);
                  // fallthrough
-        case  1: g_debug("task %p failed, fd %d, pid %d",
+        case  1: g_debug("task %p failed, extents %p, pid %d",
                          task,
-                         task->fd,
+                         task->extents,
                          task->childpid);
 
-                 g_assert_cmpint(task->status, ==, TASK_STATUS_PENDING);
+                 // Update status, unless we were discarded in the meantime.
+                 if (task_transition(task,
+                                     TASK_STATUS_PENDING,
+                                     TASK_STATUS_FAILURE)) {
+                     release_speculative_bytes(task);
+                     unregister_pending_task(task);
 
-                 // Update status.
-                 task->status = TASK_STATUS_FAILURE;
+                     // Our prediction was correct.
+                     g_atomic_int_inc(&recentfailures);
 
-                 // We now know for sure we dont need it, so we can release
-                 // these resources.
-                 g_thread_pool_push(cleanup, task, NULL);
+                     // We now know for sure we dont need it, so we can release
+                     // these resources.
+                     push_pool_job(cleanup, task);
+                 }
 
                  // All done.
                  g_mutex_unlock(&task->mutex);
@@ -544,20 +760,13 @@ static gdouble path_total_elapsed(GNode *node)
 
         g_assert_nonnull(task);
 
-        elapsed += g_timer_elapsed(task->timer, NULL);
+        elapsed += task_elapsed(task);
     }
 
     g_assert(G_NODE_IS_ROOT(node));
     return elapsed;
 }
 
-struct tree_stats {
-    gint failure;
-    gint success;
-    gint discarded;
-    gdouble elapsed;
-};
-
 static gboolean analyze_tree_helper(GNode *node, gpointer user)
 {
     struct tree_stats *stats = user;
@@ -567,18 +776,18 @@ static gboolean analyze_tree_helper(GNode *node, gpointer user)
         return false;
     }
 
-    g_assert_cmpint(task->status, !=, TASK_STATUS_PENDING);
+    g_assert_cmpint(task_status(task), !=, TASK_STATUS_PENDING);
 
     // Keep track of total compute time.
-    if (task->status != TASK_STATUS_DISCARDED) {
-        stats->elapsed += g_timer_elapsed(task->timer, NULL);
+    if (task_status(task) != TASK_STATUS_DISCARDED) {
+        stats->elapsed += task_elapsed(task);
     }
 
-    if (task->status == TASK_STATUS_SUCCESS) {
+    if (task_status(task) == TASK_STATUS_SUCCESS) {
         stats->success++;
-    } else if (task->status == TASK_STATUS_FAILURE) {
+    } else if (task_status(task) == TASK_STATUS_FAILURE) {
         stats->failure++;
-    } else if (task->status == TASK_STATUS_DISCARDED) {
+    } else if (task_status(task) == TASK_STATUS_DISCARDED) {
         stats->discarded++;
     } else {
         g_assert_not_reached();
@@ -589,12 +798,7 @@ static gboolean analyze_tree_helper(GNode *node, gpointer user)
 
 static void show_tree_statistics(void)
 {
-    struct tree_stats stats = {
-        .failure = 0,
-        .success = 0,
-        .discarded = 0,
-        .elapsed = 0,
-    };
+    struct tree_stats stats = prunedstats;
 
     g_mutex_lock(&treelock);
 
@@ -621,18 +825,13 @@ static void show_tree_statistics(void)
                     -1,
                     analyze_tree_helper,
                     &stats);
-    g_node_traverse(retired,
-                    G_IN_ORDER,
-                    G_TRAVERSE_ALL,
-                    -1,
-                    analyze_tree_helper,
-                    &stats);
 
-    g_print("%u nodes failed, %u worked, %u discarded, %u collapsed",
+    g_print("%u nodes failed, %u worked, %u discarded, %u collapsed, %u preempted",
             stats.failure,
             stats.success,
             stats.discarded,
-            g_node_n_nodes(retired, G_TRAVERSE_ALL));
+            prunednodes,
+            preemptions);
     g_print("%0.3f seconds of compute was required for final path",
             stats.elapsed);
 
@@ -654,9 +853,9 @@ static GNode * find_finalized_node(GNode *root, gboolean success)
         return final;
     }
 
-    if (task->status == TASK_STATUS_SUCCESS)
+    if (task_status(task) == TASK_STATUS_SUCCESS)
         final = root;
-    if (!success && task->status == TASK_STATUS_FAILURE)
+    if (!success && task_status(task) == TASK_STATUS_FAILURE)
         final = root;
 
     while (!G_NODE_IS_LEAF(root)) {
@@ -665,10 +864,10 @@ static GNode * find_finalized_node(GNode *root, gboolean success)
         if (task == NULL)
             break;
 
-        if (task->status == TASK_STATUS_SUCCESS) {
+        if (task_status(task) == TASK_STATUS_SUCCESS) {
             final = root;
             root  = g_node_success(root);
-        } else if (task->status == TASK_STATUS_FAILURE) {
+        } else if (task_status(task) == TASK_STATUS_FAILURE) {
             final = success ? final : root;
             root  = g_node_failure(root);
         } else {
@@ -676,19 +875,28 @@ static GNode * find_finalized_node(GNode *root, gboolean success)
         }
     }
 
+    // The loop stops when it reaches a leaf, but the leaf itself might be
+    // finalized, e.g. the last success of the last strategy.
+    if (G_NODE_IS_LEAF(root) && (task = root->data)) {
+        if (task_status(task) == TASK_STATUS_SUCCESS)
+            final = root;
+        if (!success && task_status(task) == TASK_STATUS_FAILURE)
+            final = root;
+    }
+
     // Verify that looks sane.
     if (final) {
         task = final->data;
         g_assert_nonnull(task);
-        g_assert_cmpint(task->status, !=, TASK_STATUS_PENDING);
-        g_assert_cmpint(task->status, !=, TASK_STATUS_DISCARDED);
+        g_assert_cmpint(task_status(task), !=, TASK_STATUS_PENDING);
+        g_assert_cmpint(task_status(task), !=, TASK_STATUS_DISCARDED);
     }
 
     return final;
 }
 
-// This routine will dup() the filedescriptor for the final node with status
-// TASK_STATUS_SUCCESS.
+// This routine will create a file containing the data for the final node with
+// status TASK_STATUS_SUCCESS.
 static void duplicate_final_node(gint *fd)
 {
     GNode *success;
@@ -704,10 +912,10 @@ static void duplicate_final_node(gint *fd)
     task = success->data;
 
     g_mutex_lock(&task->mutex);
-    g_assert_cmpint(task->status, ==, TASK_STATUS_SUCCESS);
-    g_assert_cmpint(task->fd, !=, -1);
+    g_assert_cmpint(task_status(task), ==, TASK_STATUS_SUCCESS);
+    g_assert_nonnull(task->extents);
 
-    *fd = dup(task->fd);
+    *fd = extent_materialize(task->extents);
 
     g_assert_cmpint(*fd, !=, -1);
     g_mutex_unlock(&task->mutex);
@@ -724,17 +932,17 @@ static gboolean cleanup_tree_helper(GNode *node, gpointer user)
     if (task == NULL)
         return false;
 
-    g_debug("cleanup task %p, fd: %d", task, task->fd);
+    g_debug("cleanup task %p, extents: %p", task, task->extents);
 
     cleanup_orphaned_tasks(task);
 
-    g_free(task->user);
-
-    if (task->timer) {
-        g_timer_destroy(task->timer);
-    }
+    // Forget its branches, or a new task at the same address would inherit
+    // them. Pending tasks still listed on them hold their own references.
+    g_mutex_lock(&pendinglock);
+    g_hash_table_remove(pendingbranches, task);
+    g_mutex_unlock(&pendinglock);
 
-    g_free(task);
+    task_free(task);
     return false;
 }
 
@@ -744,6 +952,11 @@ static void cleanup_tree(void)
 
     g_debug("cleanup_tree() acquired lock, about to free all resources");
 
+    // The pools are idle, so nothing can still be referenced.
+    reap_pruned_nodes();
+
+    g_assert(g_queue_is_empty(&graveyard));
+
     // Visit every node
     g_node_traverse(tree,
                     G_IN_ORDER,
@@ -751,16 +964,9 @@ static void cleanup_tree(void)
                     -1,
                     cleanup_tree_helper,
                     NULL);
-    g_node_traverse(retired,
-                    G_IN_ORDER,
-                    G_TRAVERSE_ALL,
-                    -1,
-                    cleanup_tree_helper,
-                    NULL);
 
     // Destroy tree
     g_node_destroy(tree);
-    g_node_destroy(retired);
 
     g_debug("cleanup_tree() complete");
 
@@ -772,9 +978,8 @@ static void cleanup_tree(void)
 
 // This routine will collapse long paths of consecutive failures to
 // compress very large trees. This should be rarely necessary.
-// Returns the new distance from the root to the finalized success node.
 // XXX: must hold tree lock.
-static gint collapse_finalized_failure_paths(void)
+static void collapse_finalized_failure_paths(void)
 {
     GNode *finalsuccess;
     GNode *finalnode;
@@ -785,52 +990,8 @@ static gint collapse_finalized_failure_paths(void)
     // There must always be at least one success node.
     g_assert_nonnull(finalsuccess);
 
-    // Find the final success node, and move it up right up to the root.
-    // All the others are transferred to the retired tree for cleanup.
-    // Makre sure finalsuccess is not the root node, and not already the first
-    // node where we would put it anyway.
-    if (finalsuccess != tree && g_node_success(tree) != finalsuccess) {
-        GNode *head = g_node_success(tree);
-        GNode *tail = finalsuccess->parent;
-
-        g_assert(g_node_is_ancestor(tree, head) == TRUE);
-        g_assert(g_node_is_ancestor(tree, finalsuccess) == TRUE);
-        g_assert(g_node_is_ancestor(head, finalsuccess) == TRUE);
-
-        g_node_unlink(head);
-
-        g_assert(g_node_is_ancestor(tree, head) == FALSE);
-        g_assert(g_node_is_ancestor(tree, finalsuccess) == FALSE);
-        g_assert(g_node_is_ancestor(head, finalsuccess) == TRUE);
-        g_assert(g_node_is_ancestor(tail, finalsuccess) == TRUE);
-
-        g_node_unlink(finalsuccess);
-
-        g_assert(g_node_is_ancestor(tree, head) == FALSE);
-        g_assert(g_node_is_ancestor(tree, finalsuccess) == FALSE);
-        g_assert(g_node_is_ancestor(head, finalsuccess) == FALSE);
-        g_assert(g_node_is_ancestor(tail, finalsuccess) == FALSE);
-
-        g_node_insert(tree, TRUE, finalsuccess);
-
-        g_assert(g_node_is_ancestor(tree, head) == FALSE);
-        g_assert(g_node_is_ancestor(tree, finalsuccess) == TRUE);
-        g_assert(g_node_is_ancestor(head, finalsuccess) == FALSE);
-
-        // Keep track of how much time we're collapsing.
-        collapsedtime += path_total_elapsed(tail);
-
-        // Cleanup all tasks on this retired tree.
-        g_node_traverse(head,
-                        G_PRE_ORDER,
-                        G_TRAVERSE_ALL,
-                        -1,
-                        abort_task_helper,
-                        NULL);
-
-        // Put it in the retired tree for cleanup by cleanup_tree()
-        g_node_insert(retired, -1, head);
-    }
+    // The finalized prefix has already been pruned.
+    g_assert(finalsuccess == tree);
 
     // Note that this returns the final node (regardless of success/fail).
     finalnode = find_finalized_node(tree, false);
@@ -852,6 +1013,8 @@ static gint collapse_finalized_failure_paths(void)
         g_assert(g_node_is_ancestor(finalsuccess, tail) == TRUE);
         g_assert(g_node_is_ancestor(tail, finalnode) == TRUE);
 
+        move_pending_tasks(finalnode, head);
+
         g_node_unlink(head);
 
         g_assert(g_node_is_ancestor(tree, finalnode) == FALSE);
@@ -870,7 +1033,7 @@ static gint collapse_finalized_failure_paths(void)
 
         // It's either root (must be success), or final success.
         task = finalsuccess->data;
-        g_assert_cmpint(task->status, ==, TASK_STATUS_SUCCESS);
+        g_assert_cmpint(task_status(task), ==, TASK_STATUS_SUCCESS);
 
         g_node_insert(finalsuccess, TRUE, finalnode);
 
@@ -880,23 +1043,13 @@ static gint collapse_finalized_failure_paths(void)
         g_assert(g_node_is_ancestor(finalsuccess, tail) == FALSE);
         g_assert(g_node_is_ancestor(tail, finalnode) == FALSE);
 
-        // Keep track of how much time we're collapsing.
+        // Keep track of how much time and depth we're collapsing.
         collapsedtime += path_total_elapsed(tail);
+        pruneddepth   += g_node_depth(tail) - g_node_depth(finalsuccess);
 
-        // Cleanup all tasks on this retired tree.
-        g_node_traverse(head,
-                        G_PRE_ORDER,
-                        G_TRAVERSE_ALL,
-                        -1,
-                        abort_task_helper,
-                        NULL);
-
-        // Put it in the retired tree for cleanup by cleanup_tree()
-        g_node_insert(retired, -1, head);
+        // Free it when the workers are finished with it.
+        retire_subtree(head);
     }
-
-    // Return the new depth so that status messages are consistent.
-    return g_node_depth(find_finalized_node(tree, true));
 }
 
 static gint print_status_message(GTimer *elapsed, gint finaldepth)
@@ -904,6 +1057,7 @@ static gint print_status_message(GTimer *elapsed, gint finaldepth)
     GNode  *finalnode;
     task_t *finaltask;
     gdouble finalelapsed;
+    gchar  *speculative;
 
     if (kQuiet == true)
         return -1;
@@ -920,23 +1074,25 @@ static gint print_status_message(GTimer *elapsed, gint finaldepth)
 
     // Print status messages if this is a terminal.
     if (isatty(STDOUT_FILENO)) {
-            printf("treesize=%u, height=%u, unproc=%u, real=%.1fs, user=%.1fs, speedup=~%.1fs\r",
-                    g_node_n_nodes(tree, G_TRAVERSE_ALL)
-                        + g_node_n_nodes(retired, G_TRAVERSE_ALL),
-                    g_node_max_height(tree)
-                        + g_node_n_nodes(retired, G_TRAVERSE_ALL),
+            speculative = g_format_size(g_atomic_pointer_get(&speculativebytes));
+            printf("treesize=%u, height=%u, unproc=%u, queue=%u (%s), spec=%s, real=%.1fs, user=%.1fs, speedup=~%.1fs\r",
+                    g_node_n_nodes(tree, G_TRAVERSE_ALL) + prunednodes,
+                    g_node_max_height(tree) + pruneddepth,
                     g_thread_pool_unprocessed(threadpool),
+                    queuedepth,
+                    queuereason,
+                    speculative,
                     g_timer_elapsed(elapsed, NULL),
                     finalelapsed,
                     finalelapsed - g_timer_elapsed(elapsed, NULL));
+            g_free(speculative);
     }
 
-    if (g_node_depth(finalnode) > finaldepth) {
-        finaldepth = g_node_depth(finalnode);
+    if (absolute_depth(finalnode) > finaldepth) {
+        finaldepth = absolute_depth(finalnode);
         g_print("New finalized size: %lu (depth=%u) real=%.1fs, user=%.1fs, speedup=~%.1fs",
                 finaltask->size,
-                g_node_depth(finalnode)
-                    + g_node_n_nodes(retired, G_TRAVERSE_ALL),
+                absolute_depth(finalnode),
                 g_timer_elapsed(elapsed, NULL),
                 finalelapsed,
                 finalelapsed - g_timer_elapsed(elapsed, NULL));
@@ -945,6 +1101,193 @@ static gint print_status_message(GTimer *elapsed, gint finaldepth)
     return finaldepth;
 }
 
+// Decide how many unprocessed workunits we're willing to queue up.
+//
+// We assume tests will fail, so a long series of failures means our guesses
+// are paying off and we can afford to speculate a little further ahead. A
+// success that invalidates pending work means we went too far, so we back off
+// quickly. If workers are finding the queue empty, the generator isn't keeping
+// up and they need more work. This is the same additive increase,
+// multiplicative decrease scheme that TCP uses.
+//
+// We never grow past --max-queue, or the number of threads if that's larger,
+// there's no point queueing more work than can run at once.
+// XXX: must hold tree lock.
+static guint adjust_queue_depth(void)
+{
+    guint previous = queuedepth;
+    guint maximum  = MAX(MAX(kMaxUnprocessed, kProcessThreads), 1);
+    gint failures;
+    gint discards;
+    gint idle;
+
+    if (kAdaptiveQueue == false) {
+        queuereason = "fixed";
+        return queuedepth = kMaxUnprocessed;
+    }
+
+    failures = g_atomic_int_get(&recentfailures);
+    discards = g_atomic_int_get(&recentdiscards);
+    idle     = g_atomic_int_get(&recentidle);
+
+    if (discards > 0) {
+        queuedepth  = MAX(queuedepth / 2, 1);
+        queuereason = "discards";
+
+        // Start counting failures again from here.
+        g_atomic_int_add(&recentdiscards, -discards);
+        g_atomic_int_add(&recentfailures, -failures);
+    } else if (failures > (gint) queuedepth) {
+        // One step for every queuedepth failures.
+        queuedepth  = MIN(queuedepth + 1, maximum);
+        queuereason = "failures";
+        g_atomic_int_add(&recentfailures, -failures);
+    } else if (idle > 0) {
+        queuedepth  = MIN(queuedepth + 1, maximum);
+        queuereason = "idle";
+    }
+
+    // Idle workers are only interesting if we haven't already reacted.
+    g_atomic_int_add(&recentidle, -idle);
+
+    if (queuedepth != previous) {
+        g_debug("speculation depth %u => %u (%s)",
+                previous,
+                queuedepth,
+                queuereason);
+    }
+
+    return queuedepth;
+}
+
+// Queue a new node for execution. The depth is recorded here rather than
+// calculated by the sort function, because we don't hold the treelock when
+// workers requeue preempted tasks.
+// XXX: must hold tree lock.
+static void submit_task(GNode *node)
+{
+    task_t    *task   = node->data;
+    task_t    *parent = node->parent->data;
+    GPtrArray *listed;
+
+    task->depth = parent->depth + 1;
+
+    // Strategy handovers are already complete, there's nothing to execute.
+    if (task_status(task) != TASK_STATUS_PENDING)
+        return;
+
+    // This data is now counted against the speculation budget until we know
+    // the result.
+    task->reserved = task->size;
+
+    g_atomic_pointer_add(&speculativebytes, task->reserved);
+
+    // List it on every branch above it in case we need to abort it.
+    listed = g_ptr_array_new_with_free_func((GDestroyNotify) g_hash_table_unref);
+
+    g_mutex_lock(&pendinglock);
+
+    for (GNode *child = node; !G_NODE_IS_ROOT(child); child = child->parent) {
+        GHashTable *branch = pending_branch(child->parent->data,
+                                            g_node_success(child->parent) == child);
+
+        g_hash_table_add(branch, task);
+        g_ptr_array_add(listed, g_hash_table_ref(branch));
+    }
+
+    g_hash_table_insert(pendingtasks, task, listed);
+    g_mutex_unlock(&pendinglock);
+
+    push_pool_job(threadpool, node);
+}
+
+// Threadpool sort function, the shallowest node is the one we need first.
+static gint compare_task_priority(gconstpointer a,
+                                  gconstpointer b,
+                                  gpointer user)
+{
+    const task_t *x = ((const GNode *) a)->data;
+    const task_t *y = ((const GNode *) b)->data;
+
+    return (x->depth > y->depth) - (x->depth < y->depth);
+}
+
+// If the next task on our path is sitting in the queue because every worker
+// is busy with deeper speculative work, kill the deepest one and requeue it.
+// The sort function ensures the critical task gets the free worker.
+// XXX: must hold tree lock.
+static void preempt_speculative_tasks(void)
+{
+    GNode  *final;
+    GNode  *critical;
+    GNode  *victim = NULL;
+    task_t *finaltask;
+    task_t *task;
+
+    if (kKillFailedWorkers == false)
+        return;
+
+    // Find the first node we don't know the result of yet.
+    final     = find_finalized_node(tree, false);
+    finaltask = final->data;
+
+    if (G_NODE_IS_LEAF(final))
+        return;
+
+    critical = task_status(finaltask) == TASK_STATUS_SUCCESS
+                ? g_node_success(final)
+                : g_node_failure(final);
+    task     = critical->data;
+
+    if (task == NULL || task_status(task) != TASK_STATUS_PENDING)
+        return;
+
+    g_mutex_lock(&runninglock);
+
+    // If the critical task is already running, or there's a free worker for
+    // it, then there's nothing to do.
+    if (g_queue_find(&running, critical) == NULL
+     && g_queue_get_length(&running) >= kProcessThreads) {
+        for (GList *l = running.head; l; l = l->next) {
+            task_t *candidate = ((GNode *) l->data)->data;
+
+            if (g_atomic_int_get(&candidate->preempted))
+                continue;
+
+            if (candidate->depth <= task->depth)
+                continue;
+
+            if (victim == NULL
+             || candidate->depth > ((task_t *) victim->data)->depth) {
+                victim = l->data;
+            }
+        }
+    }
+
+    if (victim) {
+        task_t *victimtask = victim->data;
+        GPid    childpid   = g_atomic_int_get(&victimtask->childpid);
+
+        g_debug("preempting task %p (depth %u, pid %d) for critical task %p (depth %u)",
+                victimtask,
+                victimtask->depth,
+                childpid,
+                task,
+                task->depth);
+
+        g_atomic_int_set(&victimtask->preempted, true);
+
+        // If it hasn't started yet, the worker will notice the flag.
+        if (childpid > 0) {
+            kill(-childpid, kKillFailedWorkersSignal);
+        }
+
+        preemptions++;
+    }
+
+    g_mutex_unlock(&runninglock);
+}
+
 static void generate_itermediate_file(gint finaldepth)
 {
     GNode  *finalnode;
@@ -959,9 +1302,557 @@ static void generate_itermediate_file(gint finaldepth)
     finaltask    = finalnode->data;
 
     // If this new final is 'deeper', write it out
-    if (g_node_depth(finalnode) > finaldepth) {
+    if (absolute_depth(finalnode) > finaldepth) {
         output = g_open(kOutputFile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-        g_sendfile_all(output, finaltask->fd, 0, g_file_size(finaltask->fd));
+        extent_write_fd(finaltask->extents, output);
         g_close(output, NULL);
     }
 }
+
+// Returns true if the task on this node belongs to a different strategy than
+// the one above it, the strategy was initialized on this node. Note that this
+// is recorded in the task, the tree root might just be the most recent
+// finalized success.
+gboolean g_node_strategy_root(GNode *node)
+{
+    task_t *task = node->data;
+
+    return task->first;
+}
+
+// Returns the status of the last change the strategy made on this path, use
+// this instead of the status of the task on node. A truncation task isn't a
+// change the strategy made, it's only ever created after a success, so that's
+// what the strategy sees on both branches below it.
+status_t g_node_strategy_status(GNode *node)
+{
+    task_t *task = node->data;
+
+    if (task->truncated)
+        return TASK_STATUS_SUCCESS;
+
+    return task_status(task);
+}
+
+// Ask the strategy responsible for this node to generate a new child. If the
+// strategy has no more work on this path, we hand over to the next strategy.
+// XXX: must hold tree lock.
+static task_t * generate_task(GNode *node)
+{
+    task_t *parent = node->data;
+    task_t *source = g_node_source_task(node);
+    task_t *child;
+
+    // If the child never read past some point, the rest of the data can't have
+    // mattered. Try without it before the strategy continues.
+    if (kTruncateConsumed
+     && parent->user != NULL
+     && parent->started != 0
+     && parent->consumed < parent->size
+     && task_status(parent) == TASK_STATUS_SUCCESS) {
+        return truncate_task(node);
+    }
+
+    while (true) {
+        strategy_t *strategy = &kStrategyList[parent->generation % kNumStrategies];
+
+        child = strategy->callback(node);
+
+        // The strategy initialized itself on this node, now ask for work.
+        if (child == parent)
+            continue;
+
+        if (child) {
+            child->generation = parent->generation;
+            child->roundsize  = parent->roundsize;
+            child->source     = source;
+            return child;
+        }
+
+        // If the strategy was already running, we need a handover.
+        if (parent->user != NULL)
+            break;
+
+        // The strategy wouldn't start on this input, try the next one on
+        // the same node.
+        g_info("strategy \"%s\" declined to start, skipping", strategy->name);
+
+        if (advance_strategy(parent) == false)
+            return NULL;
+    }
+
+    return handover_task(node);
+}
+
+// Create a task that removes everything after the point the child stopped
+// reading. The strategy continues from the new task as if its own change had
+// succeeded again, so we give it a copy of the parents state and mark the task
+// so g_node_strategy_status() reports that success whatever happens to it.
+// XXX: must hold tree lock.
+static task_t * truncate_task(GNode *node)
+{
+    task_t *parent = node->data;
+    task_t *child  = task_new();
+
+    g_debug("task %p only consumed %lu of %lu bytes, truncating",
+            parent,
+            parent->consumed,
+            parent->size);
+
+    child->status       = TASK_STATUS_PENDING;
+    child->generation   = parent->generation;
+    child->roundsize    = parent->roundsize;
+    child->source       = parent;
+    child->truncated    = true;
+
+    memcpy(task_user_new(child, parent->usersize), parent->user, parent->usersize);
+
+    g_mutex_lock(&parent->mutex);
+
+    // It's a success, so the data must be valid.
+    g_assert_nonnull(parent->extents);
+
+    child->extents  = extent_delete(parent->extents,
+                                    parent->consumed,
+                                    parent->size - parent->consumed);
+    child->size     = extent_size(child->extents);
+
+    g_mutex_unlock(&parent->mutex);
+
+    return child;
+}
+
+// Create a task that passes our best guess of the output of the current
+// strategy to the next one. This task doesn't need to be executed, it is
+// identical to a successful ancestor.
+//
+// The handover might be on a mispredicted path, in which case it's discarded
+// with everything else under it.
+// XXX: must hold tree lock.
+static task_t * handover_task(GNode *node)
+{
+    task_t *parent = node->data;
+    task_t *source = g_node_source_task(node);
+    task_t *child;
+
+    // If requested, don't start the next strategy until this path is final.
+    if (kOverlapStrategies == false && root_path_finalized(node) == false) {
+        g_debug("strategy finished, waiting for path to be finalized");
+        return NULL;
+    }
+
+    // The most recent success is the data we're predicting the current
+    // strategy will produce.
+    g_assert_cmpint(task_status(source), ==, TASK_STATUS_SUCCESS);
+
+    child               = task_new();
+    child->size         = source->size;
+    child->status       = TASK_STATUS_SUCCESS;
+    child->generation   = parent->generation;
+    child->roundsize    = parent->roundsize;
+    child->source       = source;
+    child->first        = true;
+
+    if (advance_strategy(child) == false) {
+        g_debug("no strategies remaining on this path");
+        task_free(child);
+        return NULL;
+    }
+
+    g_debug("handover to strategy \"%s\", size %lu",
+            kStrategyList[child->generation % kNumStrategies].name,
+            child->size);
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    // Extents are never modified, so they can be shared.
+    child->extents = g_array_ref(source->extents);
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+}
+
+// Move a task to the next strategy, returns false if there are none left.
+// If we're iterating until stable, we start another round if the last one
+// made any progress.
+static gboolean advance_strategy(task_t *task)
+{
+    // The task is left alone if we fail, we might be asked again.
+    if ((task->generation + 1) % kNumStrategies == 0) {
+        if (kIterateUntilStable == false || task->size >= task->roundsize)
+            return false;
+
+        task->roundsize = task->size;
+    }
+
+    task->generation++;
+    return true;
+}
+
+// Print a message when the finalized path crosses into a new strategy.
+// XXX: must hold tree lock.
+static void print_strategy_progress(void)
+{
+    GNode  *finalnode = find_finalized_node(tree, true);
+    GNode  *start     = finalnode;
+    task_t *finaltask = finalnode->data;
+
+    if (finaltask->generation == finalgeneration)
+        return;
+
+    // Find where this strategy started, that's the output of the previous one.
+    // If it was pruned, the root has the same data.
+    while (g_node_strategy_root(start) == false && !G_NODE_IS_ROOT(start))
+        start = start->parent;
+
+    g_print("Strategy \"%s\" complete, output %lu bytes",
+            kStrategyList[finalgeneration % kNumStrategies].name,
+            ((task_t *)(start->data))->size);
+
+    if (finaltask->generation % kNumStrategies == 0) {
+        g_print("Minimization succeeded, testing if minimization is stable...");
+    }
+
+    g_print("Input file \"%s\" is now %lu bytes, starting strategy \"%s\"...",
+            kInputFile,
+            ((task_t *)(start->data))->size,
+            kStrategyList[finaltask->generation % kNumStrategies].name);
+
+    finalgeneration = finaltask->generation;
+}
+
+// The worker pool is passed nodes, and the cleanup pool is passed tasks.
+static task_t * pool_job_task(gpointer data, gboolean worker)
+{
+    if (worker)
+        return ((GNode *)(data))->data;
+    return data;
+}
+
+// Both pools call this, it runs the real job and keeps track of how many jobs
+// are outstanding so that we can wait for the pools to go idle, and know when
+// it's safe to free pruned tasks.
+static void pool_job_helper(gpointer data, gpointer func)
+{
+    task_t *task = pool_job_task(data, func == process_execute_jobs);
+
+    ((GFunc) func)(data, NULL);
+
+    g_atomic_int_add(&task->refcount, -1);
+    g_atomic_int_add(&outstanding, -1);
+}
+
+// Queue a job on one of the pools.
+static void push_pool_job(GThreadPool *pool, gpointer data)
+{
+    task_t *task = pool_job_task(data, pool == threadpool);
+
+    g_atomic_int_inc(&task->refcount);
+    g_atomic_int_inc(&outstanding);
+    g_thread_pool_push(pool, data, NULL);
+}
+
+// Create the worker and cleanup pools. These live for the lifetime of the
+// process, creating them for every tree causes a storm of thread creation when
+// there are lots of short runs.
+static void initialize_thread_pools(void)
+{
+    if (threadpool != NULL)
+        return;
+
+    pendingbranches = g_hash_table_new_full(g_direct_hash,
+                                            g_direct_equal,
+                                            NULL,
+                                            free_pending_branches);
+    pendingtasks    = g_hash_table_new_full(g_direct_hash,
+                                            g_direct_equal,
+                                            NULL,
+                                            (GDestroyNotify) g_ptr_array_unref);
+
+    // Initialize threadpool workers, each one simply executes a testcase and
+    // updates the tree with the result.
+    threadpool = g_thread_pool_new(pool_job_helper,
+                                   process_execute_jobs,
+                                   kProcessThreads,
+                                   TRUE,
+                                   NULL);
+
+    // Tasks closest to the finalized path are the ones we're waiting for, so
+    // they should run before deeper speculative tasks.
+    g_thread_pool_set_sort_function(threadpool, compare_task_priority, NULL);
+
+    // This threadpool just cleans up tasks and mostly just waits on locks.
+    cleanup = g_thread_pool_new(pool_job_helper,
+                                cleanup_orphaned_tasks,
+                                kCleanupThreads,
+                                FALSE,
+                                NULL);
+}
+
+// Wait for every queued job to complete, the pools are then idle and can be
+// used by the next tree.
+static void drain_thread_pools(void)
+{
+    while (g_atomic_int_get(&outstanding) > 0) {
+        g_usleep(kWorkerPollDelay);
+    }
+
+    g_assert_cmpint(g_thread_pool_unprocessed(threadpool), ==, 0);
+    g_assert_cmpint(g_thread_pool_unprocessed(cleanup), ==, 0);
+}
+
+// The depth of a node including all the nodes we've pruned.
+static guint absolute_depth(GNode *node)
+{
+    return g_node_depth(node) + pruneddepth;
+}
+
+// The deepest finalized success node becomes the new root, the old root and
+// everything else above it is retired.
+// XXX: must hold tree lock.
+static void prune_finalized_prefix(void)
+{
+    GNode *finalsuccess = find_finalized_node(tree, true);
+
+    // There must always be at least one success node.
+    g_assert_nonnull(finalsuccess);
+
+    if (finalsuccess == tree)
+        return;
+
+    g_debug("pruning %u finalized nodes above %p",
+            g_node_depth(finalsuccess) - 1,
+            finalsuccess);
+
+    // Keep track of how much time and depth we're pruning. The new root is
+    // never counted by path_total_elapsed(), so include it here.
+    collapsedtime += path_total_elapsed(finalsuccess);
+    pruneddepth   += g_node_depth(finalsuccess) - 1;
+
+    g_node_unlink(finalsuccess);
+
+    // Note that we don't abort the old tree, anything on it is either
+    // finalized or has already been discarded.
+    g_queue_push_tail(&graveyard, tree);
+
+    tree = finalsuccess;
+
+    // The root is a success, so it's its own source. Don't keep a pointer
+    // into the graveyard.
+    ((task_t *) tree->data)->source = NULL;
+}
+
+// Detach a subtree and discard everything on it, it will be freed by
+// reap_pruned_nodes() once workers are finished with it.
+// XXX: must hold tree lock.
+static void retire_subtree(GNode *head)
+{
+    task_t *task = head->data;
+
+    g_assert(G_NODE_IS_ROOT(head));
+
+    // Anything already completed is released when the subtree is freed.
+    g_mutex_lock(&pendinglock);
+
+    if (g_hash_table_contains(pendingtasks, task))
+        push_pool_job(cleanup, task);
+
+    discard_pending_branch(task, false);
+    discard_pending_branch(task, true);
+
+    g_mutex_unlock(&pendinglock);
+
+    g_queue_push_tail(&graveyard, head);
+}
+
+static gboolean task_referenced_helper(GNode *node, gpointer user)
+{
+    task_t   *task       = node->data;
+    gboolean *referenced = user;
+
+    if (task && g_atomic_int_get(&task->refcount) > 0) {
+        *referenced = true;
+    }
+
+    return *referenced;
+}
+
+// Free any retired subtrees that are no longer referenced by a pool job, we
+// only keep a summary of the tasks.
+// XXX: must hold tree lock.
+static void reap_pruned_nodes(void)
+{
+    for (GList *curr = graveyard.head, *next; curr; curr = next) {
+        GNode   *head       = curr->data;
+        gboolean referenced = false;
+
+        next = curr->next;
+
+        g_node_traverse(head,
+                        G_PRE_ORDER,
+                        G_TRAVERSE_ALL,
+                        -1,
+                        task_referenced_helper,
+                        &referenced);
+
+        // Try again later.
+        if (referenced)
+            continue;
+
+        g_node_traverse(head,
+                        G_IN_ORDER,
+                        G_TRAVERSE_ALL,
+                        -1,
+                        analyze_tree_helper,
+                        &prunedstats);
+
+        prunednodes += g_node_n_nodes(head, G_TRAVERSE_ALL);
+
+        g_node_traverse(head,
+                        G_IN_ORDER,
+                        G_TRAVERSE_ALL,
+                        -1,
+                        cleanup_tree_helper,
+                        NULL);
+
+        g_node_destroy(head);
+        g_queue_delete_link(&graveyard, curr);
+    }
+}
+
+// A task is no longer pending, so it doesn't count towards the budget.
+static void release_speculative_bytes(task_t *task)
+{
+    g_atomic_pointer_add(&speculativebytes, -(gssize) task->reserved);
+
+    task->reserved = 0;
+}
+
+// Check if pending tasks are holding more data than we allow. We always allow
+// at least one pending task, or we could never make progress.
+static gboolean speculative_budget_exhausted(void)
+{
+    gssize pending = g_atomic_pointer_get(&speculativebytes);
+
+    if (kMaxSpeculativeBytes <= 0)
+        return false;
+
+    return pending > 0 && pending >= kMaxSpeculativeBytes;
+}
+
+// Returns the task a new child of node should get its data from, the nearest
+// successful task at or above node. This never needs to traverse the tree,
+// every task records its source when it's created.
+//
+// This is always an ancestor on the success path of the child, so it's never
+// pruned while the child is reachable.
+task_t * g_node_source_task(GNode *node)
+{
+    task_t *task = node->data;
+
+    if (task_status(task) == TASK_STATUS_SUCCESS)
+        return task;
+
+    g_assert_nonnull(task->source);
+    g_assert_cmpint(task_status(task->source), ==, TASK_STATUS_SUCCESS);
+
+    return task->source;
+}
+
+// A task is no longer pending, so it can't be aborted.
+static void unregister_pending_task(task_t *task)
+{
+    GPtrArray *listed;
+
+    g_mutex_lock(&pendinglock);
+
+    if ((listed = g_hash_table_lookup(pendingtasks, task))) {
+        for (guint i = 0; i < listed->len; i++) {
+            g_hash_table_remove(g_ptr_array_index(listed, i), task);
+        }
+
+        g_hash_table_remove(pendingtasks, task);
+    }
+
+    g_mutex_unlock(&pendinglock);
+}
+
+// Returns the set of pending tasks on one branch below task, creating it if
+// necessary.
+// XXX: must hold pendinglock.
+static GHashTable * pending_branch(task_t *task, gboolean success)
+{
+    GHashTable **branches = g_hash_table_lookup(pendingbranches, task);
+
+    if (branches == NULL) {
+        branches = g_new0(GHashTable *, 2);
+        g_hash_table_insert(pendingbranches, task, branches);
+    }
+
+    if (branches[success] == NULL) {
+        branches[success] = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    return branches[success];
+}
+
+static void free_pending_branches(gpointer data)
+{
+    GHashTable **branches = data;
+
+    for (guint i = 0; i < 2; i++) {
+        if (branches[i]) {
+            g_hash_table_unref(branches[i]);
+        }
+    }
+
+    g_free(branches);
+}
+
+// Node is about to be moved out from under head, so the pending tasks below it
+// are no longer below head or any node between them.
+// XXX: must hold tree lock.
+static void move_pending_tasks(GNode *node, GNode *head)
+{
+    GHashTable *stale = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTable *moving;
+    GList      *tasks;
+
+    g_mutex_lock(&pendinglock);
+
+    for (GNode *child = node; child != head; child = child->parent) {
+        GHashTable *branch = lookup_pending_branch(child->parent->data,
+                                                   g_node_success(child->parent) == child);
+
+        if (branch) {
+            g_hash_table_add(stale, branch);
+        }
+    }
+
+    // The branch directly above node has exactly the tasks that are moving.
+    moving = lookup_pending_branch(node->parent->data,
+                                   g_node_success(node->parent) == node);
+    tasks  = moving ? g_hash_table_get_keys(moving) : NULL;
+
+    for (GList *curr = tasks; curr; curr = curr->next) {
+        GPtrArray *listed = g_hash_table_lookup(pendingtasks, curr->data);
+
+        for (guint i = listed->len; i-- > 0;) {
+            GHashTable *branch = g_ptr_array_index(listed, i);
+
+            if (g_hash_table_contains(stale, branch)) {
+                g_hash_table_remove(branch, curr->data);
+                g_ptr_array_remove_index_fast(listed, i);
+            }
+        }
+    }
+
+    g_mutex_unlock(&pendinglock);
+
+    g_list_free(tasks);
+    g_hash_table_unref(stale);
+}
@@ -23,11 +23,13 @@
 #define g_node_failure(n) g_node_nth_child(n, FALSE)
 
 gboolean build_bisection_tree(gint fd,
-                              strategy_cb_t callback,
                               gint *outfd,
                               gulong flags);
+gboolean g_node_strategy_root(GNode *node);
+status_t g_node_strategy_status(GNode *node);
+task_t * g_node_source_task(GNode *node);
 void cleanup_orphaned_tasks(task_t *task);
-void abort_pending_tasks(GNode *root);
+void abort_pending_tasks(task_t *task);
 void process_execute_jobs(GNode *node);
 
 typedef struct {
@@ -42,17 +44,51 @@ typedef struct {
 extern gint kNumStrategies;
 extern strategy_t kStrategyList[MAX_STRATEGIES];
 
+// Strategies can also be loaded from a shared object with --strategy-plugin.
+// The plugin defines HALFEMPTY_PLUGIN before including this file, then uses
+// REGISTER_STRATEGY() as usual and STRATEGY_PLUGIN() once. Its strategies are
+// recorded in a table inside the plugin, and only copied into kStrategyList
+// after we've checked it was built against compatible headers. Increment the
+// version whenever task_t, strategy_t or the functions strategies use change.
+#define STRATEGY_ABI_VERSION 3
+
+typedef struct {
+    guint   version;
+    gsize   tasksize;
+    gsize   strategysize;
+} strategy_abi_t;
+
+#ifndef HALFEMPTY_PLUGIN
+# define STRATEGY_TABLE kStrategyList
+# define STRATEGY_COUNT kNumStrategies
+#else
+# define STRATEGY_TABLE halfempty_strategies
+# define STRATEGY_COUNT halfempty_num_strategies
+
+extern gint halfempty_num_strategies;
+extern strategy_t halfempty_strategies[MAX_STRATEGIES];
+#endif
+
 #define REGISTER_STRATEGY(_name, _desc, _options, _callback)            \
     static void __attribute__((constructor)) __init__ ## _name (void)   \
     {                                                                   \
-        kStrategyList[kNumStrategies].name          = # _name;          \
-        kStrategyList[kNumStrategies].options       = _options;         \
-        kStrategyList[kNumStrategies].description   = _desc;            \
-        kStrategyList[kNumStrategies].callback      = _callback;        \
-        kNumStrategies++;                                               \
-        g_assert_cmpint(kNumStrategies, <, MAX_STRATEGIES);             \
+        STRATEGY_TABLE[STRATEGY_COUNT].name         = # _name;          \
+        STRATEGY_TABLE[STRATEGY_COUNT].options      = _options;         \
+        STRATEGY_TABLE[STRATEGY_COUNT].description  = _desc;            \
+        STRATEGY_TABLE[STRATEGY_COUNT].callback     = _callback;        \
+        STRATEGY_COUNT++;                                               \
+        g_assert_cmpint(STRATEGY_COUNT, <, MAX_STRATEGIES);             \
     }
 
+#define STRATEGY_PLUGIN()                                               \
+    const strategy_abi_t halfempty_strategy_abi = {                     \
+        .version        = STRATEGY_ABI_VERSION,                         \
+        .tasksize       = sizeof(task_t),                               \
+        .strategysize   = sizeof(strategy_t),                           \
+    };                                                                  \
+    gint halfempty_num_strategies;                                      \
+    strategy_t halfempty_strategies[MAX_STRATEGIES]
+
 #define BISECT_FLAG_NOFLAGS    (0)
 #define BISECT_FLAG_CLOSEINPUT (1 << 0)
 
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define G_LOG_DOMAIN "trim"
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "task.h"
+#include "tree.h"
+#include "extent.h"
+
+// This file is part of halfempty - a fast, parallel testcase minimization tool.
+//
+// Inputs often have a long irrelevant header or tail, bisect would take many
+// sequential steps to discover that. Instead, we search for the longest prefix
+// we can remove, and then the longest suffix.
+//
+// We never try removing everything, bisect already starts with that.
+//
+// Each round tries several cut points at once, longest first. These are
+// emitted as a chain of predicted failures, so they're tested in parallel,
+// and the first success in the chain is the longest cut that worked. The next
+// round searches between that and the next longest cut, which failed.
+//
+
+enum {
+    TRIM_PREFIX,
+    TRIM_SUFFIX,
+};
+
+// The structure of our user data.
+typedef struct {
+    gint    phase;      // Trimming the prefix or suffix.
+    gsize   limit;      // Longest cut that might work this round.
+    guint   index;      // Which cut this candidate is, -1 for none.
+} trim_t;
+
+// Configurable Knobs.
+static gboolean kTrimEnabled = false;
+static gint kTrimWays = 8;
+
+static const GOptionEntry kTrimOptions[] = {
+    { "trim", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &kTrimEnabled,
+        "Try to trim the start and end of the file before the other strategies.",
+        NULL },
+    { "trim-ways", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &kTrimWays,
+        "Number of cut points to try in each round (default=8).",
+        "ways" },
+    { NULL },
+};
+
+static const gchar kDescription[] =
+    "Remove the longest possible prefix and suffix from the file";
+
+// Number of cuts in a round, they must all be different.
+static guint round_length(gsize limit)
+{
+    return MIN(MAX(kTrimWays, 1), limit);
+}
+
+// The length of the cut for this index, longest first.
+static gsize cut_length(gsize limit, guint index)
+{
+    guint ways = round_length(limit);
+
+    return limit * (ways - index) / ways;
+}
+
+// Start a new round, moving on to the next phase if there's nothing to find.
+static gboolean start_round(trim_t *status, gsize limit, gsize size)
+{
+    status->limit = limit;
+    status->index = 0;
+
+    if (status->limit == 0 && status->phase == TRIM_PREFIX) {
+        g_info("finished trimming prefix, trimming suffix");
+        status->phase = TRIM_SUFFIX;
+        status->limit = MAX(size, 1) - 1;
+    }
+
+    return status->limit > 0;
+}
+
+static task_t * strategy_trim_data(GNode *node)
+{
+    task_t  *child  = NULL;             // The new task we're about to return.
+    task_t  *parent = node->data;       // The task above us in the tree.
+    task_t  *source;                    // Where we get our data from.
+    gsize    cut;
+
+    // We don't hold the lock on parent, but user data will never change.
+    trim_t  *parentstatus = parent->user;
+    trim_t  *childstatus;
+
+    g_debug("strategy_trim_data(%p)", node);
+
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
+        if (kTrimEnabled == false || parent->size < 2)
+            return NULL;
+
+        childstatus         = task_user_new(parent, sizeof(trim_t));
+        childstatus->phase  = TRIM_PREFIX;
+        childstatus->limit  = parent->size - 1;
+        childstatus->index  = -1;
+        return parent;
+    }
+
+    source = g_node_source_task(node);
+
+    // Initialize child from parent.
+    child           = task_new();
+    child->status   = TASK_STATUS_PENDING;
+    childstatus     = task_user_new(child, sizeof(trim_t));
+
+    memcpy(childstatus, parentstatus, sizeof(trim_t));
+
+    if (g_node_strategy_root(node)) {
+        // This is the first cut.
+        childstatus->index = 0;
+    } else if (g_node_strategy_status(node) == TASK_STATUS_SUCCESS) {
+        cut = cut_length(parentstatus->limit, parentstatus->index);
+
+        g_info("removing %lu bytes worked", cut);
+
+        // Search between this cut and the previous one, which failed. If this
+        // was the first cut, there is nothing left to find.
+        if (!start_round(childstatus,
+                         parentstatus->index > 0
+                            ? cut_length(parentstatus->limit, parentstatus->index - 1) - cut - 1
+                            : 0,
+                         source->size)) {
+            goto nochild;
+        }
+    } else if (++childstatus->index == round_length(childstatus->limit)) {
+        // Every cut failed, so search below the shortest.
+        cut = cut_length(childstatus->limit, childstatus->index - 1);
+
+        if (!start_round(childstatus, cut - 1, source->size)) {
+            goto nochild;
+        }
+    }
+
+    cut = cut_length(childstatus->limit, childstatus->index);
+
+    g_mutex_lock(&source->mutex);
+
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
+
+    if (childstatus->phase == TRIM_PREFIX) {
+        child->extents = extent_delete(source->extents, 0, cut);
+    } else {
+        child->extents = extent_delete(source->extents, source->size - cut, cut);
+    }
+
+    child->size = extent_size(child->extents);
+
+    g_mutex_unlock(&source->mutex);
+
+    return child;
+
+  nochild:
+    g_info("finished trimming suffix");
+    task_free(child);
+    return NULL;
+}
+
+// Add this strategy to the global list.
+REGISTER_STRATEGY(trim, kDescription, kTrimOptions, strategy_trim_data);
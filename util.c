@@ -101,14 +101,14 @@ static gboolean draw_tree_helper(GNode *node, gpointer user)
     };
 
     if (data) {
-        if (data->status == TASK_STATUS_DISCARDED && kSimplifyDotFile) {
+        if (task_status(data) == TASK_STATUS_DISCARDED && kSimplifyDotFile) {
             // Simplify the graph by ignoring discarded branches.
             return false;
         }
         fprintf(out, "\"%p\" [label=\"%lu bytes\" style=filled fillcolor=%s];\n",
                      node,
                      data->size,
-                     taskcolor[data->status]);
+                     taskcolor[task_status(data)]);
     }
 
     if (node->children) {
@@ -178,15 +178,16 @@ gssize g_sendfile(gint outfd, gint infd, goffset offset, gsize count)
 // A more convenient wrapper for sendfile.
 gboolean g_sendfile_all(gint outfd, gint infd, goffset offset, gsize count)
 {
-    gsize result;
+    gssize result;
     gsize total;
 
     total = 0;
 
     while (total < count) {
-        result = g_sendfile(outfd, infd, offset, count - total);
+        result = g_sendfile(outfd, infd, offset + total, count - total);
 
-        if (result < 0)
+        // Zero means the file is shorter than we expected.
+        if (result <= 0)
            break;
 
         total += result;
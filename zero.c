@@ -33,14 +33,26 @@
 #include "proc.h"
 #include "util.h"
 #include "tree.h"
+#include "extent.h"
 
 // This file is part of halfempty - a fast, parallel testcase minimization tool.
 
 
+// A range of the data, from start up to (but not including) end.
+typedef struct {
+    gsize   start;
+    gsize   end;
+} interval_t;
+
 // The structure of our user data.
+// Each node also records the ranges that successful ancestors on its path have
+// already zeroed, sorted and merged, so that we don't have to walk the tree to
+// find them.
 typedef struct {
-    size_t  offset;
-    size_t  chunksize;
+    size_t      offset;
+    size_t      chunksize;
+    guint       count;
+    interval_t  zeroed[];
 } bisect_t;
 
 // Configurable Knobs.
@@ -61,6 +73,74 @@ static const GOptionEntry kZeroOptions[] = {
 static const gchar kDescription[] =
     "Zero consecutively larger chunks of data from the file";
 
+// Create the status for task, a child of parent. If parent was successful
+// then its range is added to the zeroed intervals.
+static bisect_t * new_child_status(task_t *task, bisect_t *parent, gboolean success)
+{
+    bisect_t  *child;
+    gsize      start = parent->offset;
+    gsize      end   = parent->offset + parent->chunksize;
+    guint      i     = 0;
+
+    child = task_user_new(task, sizeof(bisect_t)
+                            + sizeof(interval_t) * (parent->count + success));
+
+    child->offset       = parent->offset;
+    child->chunksize    = parent->chunksize;
+    child->count        = 0;
+
+    if (success == false) {
+        child->count = parent->count;
+        memcpy(child->zeroed, parent->zeroed, sizeof(interval_t) * parent->count);
+        return child;
+    }
+
+    // Copy the intervals before this one.
+    for (; i < parent->count && parent->zeroed[i].end < start; i++) {
+        child->zeroed[child->count++] = parent->zeroed[i];
+    }
+
+    // Merge any that overlap or touch.
+    for (; i < parent->count && parent->zeroed[i].start <= end; i++) {
+        start = MIN(start, parent->zeroed[i].start);
+        end   = MAX(end, parent->zeroed[i].end);
+    }
+
+    child->zeroed[child->count].start   = start;
+    child->zeroed[child->count].end     = end;
+    child->count++;
+
+    // And the ones after.
+    for (; i < parent->count; i++) {
+        child->zeroed[child->count++] = parent->zeroed[i];
+    }
+
+    return child;
+}
+
+// Find the zeroed interval containing offset, or NULL.
+static interval_t * find_zeroed_interval(bisect_t *status, gsize offset)
+{
+    guint lo = 0;
+    guint hi = status->count;
+
+    // Find the last interval that starts at or before offset.
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (status->zeroed[mid].start <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0 || status->zeroed[lo - 1].end <= offset)
+        return NULL;
+
+    return &status->zeroed[lo - 1];
+}
+
 // Create a new node derived from the parent that can be inserted into our
 // binary tree. node is a pointer to the current leaf, which we need to prepare
 // a child for. i.e. node will be our parent.
@@ -80,12 +160,12 @@ static task_t * strategy_zero_data(GNode *node)
 
     // We don't hold the lock on parent, but user data will never change.
     bisect_t *parentstatus  = parent->user;
-    bisect_t *childstatus   = g_new0(bisect_t, 1);
+    bisect_t *childstatus   = NULL;
 
     g_debug("strategy_bisect_data(%p)", node);
 
-    // If this is the root node, we're being called to initialize a new tree.
-    if (parentstatus == NULL && G_NODE_IS_ROOT(node)) {
+    // If this is a new strategy root, we're being called to initialize it.
+    if (parentstatus == NULL) {
         g_debug("initializing a new root node %p, size %lu",
                 node,
                 parent->size);
@@ -93,20 +173,26 @@ static task_t * strategy_zero_data(GNode *node)
         // If this was already set, then something has gone wrong.
         g_assert_cmpint(g_node_n_children(node), ==, 0);
 
+        childstatus             = task_user_new(parent, sizeof(bisect_t));
         childstatus->offset     = 0;
         childstatus->chunksize  = parent->size;
-        parent->user            = childstatus;
         return parent;
     }
 
     g_assert_nonnull(parentstatus);
 
     // Initialize child from parent.
-    child           = g_new0(task_t, 1);
-    child->fd       = -1;
+    child           = task_new();
     child->size     = parent->size;
     child->status   = TASK_STATUS_PENDING;
-    child->user     = memcpy(childstatus, parentstatus, sizeof(bisect_t));
+
+    // If the parent was successful, we're on its success path and its range
+    // is already zeroed. If it becomes successful later, we just lose the
+    // chance to skip it.
+    childstatus = new_child_status(child,
+                                   parentstatus,
+                                   g_node_strategy_status(node) == TASK_STATUS_SUCCESS
+                                    && !g_node_strategy_root(node));
 
     // Check if we've finished a chunksize.
     if (parentstatus->offset + parentstatus->chunksize > parent->size) {
@@ -136,50 +222,31 @@ static task_t * strategy_zero_data(GNode *node)
   restart:
 
     // Here is the problem, it's pointless trying to zero out chunks we've
-    // already zeroed out. This means we need to start at the root, and see if
-    // our offset + chunksize is already inside a SUCCESS node (don't care about
+    // already zeroed out. Successful ancestors on our path have recorded what
+    // they zeroed, so skip any chunks inside those ranges (don't care about
     // FAIL, because we're smaller).
-    for (GNode *current = node;
-         !G_NODE_IS_ROOT(current);
-         current = current->parent) {
-        gboolean adjusted = false;
-        task_t  *currtask = current->data;
-
-        g_assert_nonnull(currtask);
-        g_assert_nonnull(currtask->user);
-
-        if (currtask->status == TASK_STATUS_SUCCESS) {
-            bisect_t *b = currtask->user;
-
-            // An ancestor cannot possibly have a smaller chunksize.
-            g_assert_cmpint(childstatus->chunksize, <=, b->chunksize);
-
-            while (childstatus->offset >= b->offset
-                && childstatus->offset + childstatus->chunksize
-                    <= b->offset + b->chunksize) {
-                adjusted = true;
-                adjust++;
-                g_debug("offset %lu (chunksize %lu) already encapsulated",
-                        childstatus->offset,
-                        childstatus->chunksize);
-
-                if ((childstatus->offset += childstatus->chunksize)
-                        > parent->size) {
-                    g_debug("adjustment caused a new cycle to start, %lu",
-                            childstatus->chunksize >> 1);
-
-                    childstatus->offset = 0;
-                    childstatus->chunksize >>= 1;
-
-                    if (childstatus->chunksize == 0) {
-                        g_info("final cycle complete.");
-                        goto nochild;
-                    }
-                }
-            }
+    for (interval_t *zeroed;
+         (zeroed = find_zeroed_interval(childstatus, childstatus->offset))
+            && childstatus->offset + childstatus->chunksize <= zeroed->end;) {
+        adjust++;
+        g_debug("offset %lu (chunksize %lu) already encapsulated",
+                childstatus->offset,
+                childstatus->chunksize);
+
+        // Skip every chunk that fits inside this interval.
+        childstatus->offset += childstatus->chunksize
+            * ((zeroed->end - childstatus->offset) / childstatus->chunksize);
 
-            if (adjusted) {
-                goto restart;
+        if (childstatus->offset > parent->size) {
+            g_debug("adjustment caused a new cycle to start, %lu",
+                    childstatus->chunksize >> 1);
+
+            childstatus->offset = 0;
+            childstatus->chunksize >>= 1;
+
+            if (childstatus->chunksize == 0) {
+                g_info("final cycle complete.");
+                goto nochild;
             }
         }
     }
@@ -189,47 +256,16 @@ static task_t * strategy_zero_data(GNode *node)
            childstatus->offset,
            childstatus->chunksize);
 
-    // Traverse up the tree to find the first SUCCESS node, we base our data on
-    // that.
-    if (source->status != TASK_STATUS_SUCCESS) {
-        for (GNode *current = node; current; current = current->parent) {
-            source = current->data;
-            if (source->status == TASK_STATUS_SUCCESS) {
-                break;
-            }
-        }
-
-        // The root node has TASK_STATUS_SUCCESS, so this is impossible.
-        g_assert(source);
-    }
+    // Find the first SUCCESS node above us, we base our data on that.
+    source = g_node_source_task(node);
 
     // OK, looks like we've never tried zeroing this chunk before.
     // What if it is already zero though, it's pointless trying it again.
-    gpointer b1 = g_malloc0(childstatus->chunksize);
-    gpointer b2 = g_malloc0(childstatus->chunksize);
-    gssize count = pread(source->fd,
-                         b1,
+    if (extent_is_filled(source->extents,
+                         childstatus->offset,
                          childstatus->chunksize,
-                         childstatus->offset);
-
-    if (kZeroCharacter != 0) {
-        memset(b2, kZeroCharacter, childstatus->chunksize);
-    }
-
-    if (count != childstatus->chunksize) {
-        g_info("%ld != %lu (offset %lu, size %lu, chunksize %lu)",
-               count,
-               childstatus->chunksize,
-               childstatus->offset,
-               parent->size,
-               childstatus->chunksize);
-        g_assert_cmpint(count, >=, 0);
-    }
-
-    if (memcmp(b1, b2, childstatus->chunksize) == 0) {
+                         (guchar) kZeroCharacter)) {
         g_info("skipping chunk, already all %#02x", kZeroCharacter);
-        g_free(b1);
-        g_free(b2);
 
         if ((childstatus->offset += childstatus->chunksize) > parent->size) {
             g_debug("adjustment caused a new cycle to start, new chunksize %lu",
@@ -246,77 +282,32 @@ static task_t * strategy_zero_data(GNode *node)
 
         goto restart;
     }
-    g_free(b1);
-    g_free(b2);
-
 
     // OK, we need this guy, acquire the lock.
     g_mutex_lock(&source->mutex);
 
-    // If it's success, the fd must be open and valid.
-    g_assert_cmpint(source->fd, !=, -1);
+    // If it's success, the data must be valid.
+    g_assert_nonnull(source->extents);
 
     // This cannot possibly be wrong.
-    g_assert_cmpuint(source->size, ==, g_file_size(source->fd));
-
-    // OK, we can do a bisection now.
-    child->fd = g_unlinked_tmp(NULL);
-
-    // Size should never change for this strategy.
-    child->size = source->size;
+    g_assert_cmpuint(source->size, ==, extent_size(source->extents));
 
     // i didn't think this was possible because how can child be smaller than
     // an ancestor?
     if (childstatus->offset > source->size)
         goto nochildunlock;
 
-    if (g_sendfile_all(child->fd,
-                       source->fd,
-                       0,
-                       childstatus->offset) == false) {
-        g_critical("sendfile failed while trying to construct new file");
-        g_assert_not_reached();
-        goto nochildunlock;
-    }
-
-    if (kZeroCharacter == '\0') {
-        // Insert some nuls, ftruncate() will do this for free.
-        if (ftruncate(child->fd,
-                      MIN(source->size,
-                          childstatus->offset + childstatus->chunksize)) != 0) {
-            g_warning("ftruncate failure while zeroing chunk, %m");
-        }
-    } else {
-        gchar *buf = g_malloc(MIN(source->size - childstatus->offset,
-                                  childstatus->chunksize));
-        memset(buf, kZeroCharacter, MIN(source->size - childstatus->offset,
-                                        childstatus->chunksize));
-
-        if (write(child->fd, buf, MIN(source->size - childstatus->offset,
-                                      childstatus->chunksize)) < 0) {
-            g_warning("write failed while zeroing chunk, %m");
-        }
-        
-        g_free(buf);
-    }
+    // OK, we can do a bisection now.
+    child->extents = extent_fill(source->extents,
+                                 childstatus->offset,
+                                 MIN(source->size - childstatus->offset,
+                                     childstatus->chunksize),
+                                 (guchar) kZeroCharacter);
 
-    // ftruncate does not update offset.
-    lseek(child->fd, 0, SEEK_END);
-
-    if (childstatus->offset + childstatus->chunksize <= source->size) {
-        if (g_sendfile_all(child->fd,
-                           source->fd,
-                           childstatus->offset + childstatus->chunksize,
-                           source->size
-                            - childstatus->chunksize
-                            - childstatus->offset) == false) {
-            g_warning("sendfile failed while trying to construct new file");
-            g_assert_not_reached();
-            goto nochildunlock;
-        }
-    }
+    // Size should never change for this strategy.
+    child->size = source->size;
 
-    g_assert_cmpuint(child->size, ==, g_file_size(child->fd));
+    g_assert_cmpuint(child->size, ==, extent_size(child->extents));
 
     // Finished with source object.
     g_mutex_unlock(&source->mutex);
@@ -327,11 +318,10 @@ static task_t * strategy_zero_data(GNode *node)
     g_mutex_unlock(&source->mutex);
 
   nochild:
-    if (child) {
-        close(child->fd);
+    if (child->extents) {
+        g_array_unref(child->extents);
     }
-    g_free(child);
-    g_free(childstatus);
+    task_free(child);
     return NULL;
 }
 